@@ -24,6 +24,7 @@
 #include "lvm.c"
 #include "lzio.c"
 
+#include "larraylib.c"
 #include "lauxlib.c"
 #include "lbaselib.c"
 #include "ldblib.c"
@@ -32,6 +33,7 @@
 #include "lmathlib.c"
 #include "loadlib.c"
 #include "loslib.c"
+#include "lstrbuflib.c"
 #include "lstrlib.c"
 #include "ltablib.c"
 
@@ -369,6 +369,13 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
     lua_unlock(L);
   }
   if (len != NULL) *len = tsvalue(o)->len;
+  if (isrope(rawtsvalue(o))) {  /* must not move while `o' lives */
+    const char *s;
+    lua_lock(L);
+    s = luaS_cstr(L, rawtsvalue(o));
+    lua_unlock(L);
+    return s;
+  }
   return svalue(o);
 }
 
@@ -466,6 +473,27 @@ LUA_API void lua_pushlstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+/*
+** Pushes a string whose bytes stay at `s' (which must be followed by a
+** '\0'): no copy is made. When the string is collected, or if it is
+** short enough to be interned (which copies it at once), `s' is given
+** back through `falloc(ud, s, l + 1, 0)'; `falloc' may be NULL. After a
+** memory error here `s' still belongs to the caller.
+*/
+LUA_API const char *lua_pushexternalstring (lua_State *L, const char *s,
+                                size_t l, lua_Alloc falloc, void *ud) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, s[l] == '\0');
+  luaC_checkGC(L);
+  ts = luaS_newextlstr(L, s, l, falloc, ud);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
+
 LUA_API void lua_pushstring (lua_State *L, const char *s) {
   if (s == NULL)
     lua_pushnil(L);
@@ -792,6 +820,16 @@ LUA_API int lua_setfenv (lua_State *L, int idx) {
 }
 
 
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2adr(L, idx);
+  api_check(L, ttistable(t));
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
 /*
 ** `load' and `call' functions (run Lua code)
 */
@@ -928,6 +966,15 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
 }
 
 
+LUA_API int lua_heapsnapshot (lua_State *L, lua_Writer writer, void *data) {
+  int status;
+  lua_lock(L);
+  status = luaC_snapshot(L, writer, data);
+  lua_unlock(L);
+  return status;
+}
+
+
 LUA_API int  lua_status (lua_State *L) {
   return L->status;
 }
@@ -996,6 +1043,24 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCDEFERFINALIZERS: {
+      res = g->gcdeferfin;
+      g->gcdeferfin = (data != 0);
+      break;
+    }
+    case LUA_GCRUNFINALIZERS: {
+      res = luaC_runfinalizers(L, data);
+      break;
+    }
+    case LUA_GCSETLIMIT: {  /* limit in Kbytes; 0 removes it */
+      res = cast_int(g->memlimit >> 10);
+      g->memlimit = (data > 0) ? cast(lu_mem, data) << 10 : 0;
+      break;
+    }
+    case LUA_GCLIMIT: {
+      res = cast_int(g->memlimit >> 10);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1003,6 +1068,13 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+LUA_API void lua_getgcstats (lua_State *L, lua_GCStats *s) {
+  lua_lock(L);
+  *s = G(L)->gcstats;
+  lua_unlock(L);
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1077,6 +1149,18 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_unlock(L);
 }
 
+
+/*
+** With a `freeall' function, lua_close still calls pending finalizers
+** but then gives the whole heap back through it, without visiting each
+** object.
+*/
+LUA_API void lua_setfreeall (lua_State *L, lua_FreeAll f) {
+  lua_lock(L);
+  G(L)->freeall = f;
+  lua_unlock(L);
+}
+
 /**
  * 分配一块指定大小的内存块，把内存地址作为一个完全用户数据压栈，并返回这个地址。
  * 宿主程序可以随意使用这块内存。
@@ -0,0 +1,410 @@
+/*
+** $Id: larraylib.c $
+** Typed arrays: dense vectors of numbers stored in userdata
+** See Copyright Notice in lua.h
+*/
+
+
+#include <stddef.h>
+#include <string.h>
+
+#define larraylib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** An array is a full userdata holding a header and its elements; the
+** collector never looks into userdata, so the size of an array does
+** not affect the cost of a collection.
+*/
+typedef struct TArray {
+  size_t size;  /* number of elements */
+  int type;
+  union { LUAI_USER_ALIGNMENT_T dummy; unsigned char b[1]; } data;
+} TArray;
+
+
+enum { AINT8, AUINT8, AINT16, AUINT16, AINT32, AUINT32, AFLOAT32, AFLOAT64 };
+
+static const char *const typenames[] = {
+  "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64",
+  NULL
+};
+
+static const size_t typesizes[] = {
+  sizeof(signed char), sizeof(unsigned char), sizeof(short),
+  sizeof(unsigned short), sizeof(LUAI_INT32), sizeof(LUAI_UINT32),
+  sizeof(float), sizeof(double)
+};
+
+
+#define elems(a,T)	((T *)(a)->data.b)
+
+#define toarray(L,i)	((TArray *)luaL_checkudata(L, i, LUA_ARRAYHANDLE))
+
+
+/*
+** runs `OP(T)' with `T' the C type of the elements of `a'
+*/
+#define dispatch(a,OP) \
+  switch ((a)->type) { \
+    case AINT8: OP(signed char); break; \
+    case AUINT8: OP(unsigned char); break; \
+    case AINT16: OP(short); break; \
+    case AUINT16: OP(unsigned short); break; \
+    case AINT32: OP(LUAI_INT32); break; \
+    case AUINT32: OP(LUAI_UINT32); break; \
+    case AFLOAT32: OP(float); break; \
+    default: OP(double); break; \
+  }
+
+
+/*
+** converts a number to the C type `T' of an element; integer types
+** take the integer part of the value (as `lua_tointeger')
+*/
+#define isfloattype(T)	((T)0.5 != (T)0)
+
+#define tofield(T,v) \
+  (isfloattype(T) ? (T)(v) : (T)tointeger(v))
+
+
+static lua_Integer tointeger (lua_Number v) {
+  lua_Integer i;
+  lua_number2integer(i, v);
+  return i;
+}
+
+
+static lua_Number getelem (const TArray *a, size_t i) {
+#define GET(T)	return (lua_Number)elems(a, T)[i]
+  dispatch(a, GET);
+#undef GET
+  return 0;  /* to avoid warnings */
+}
+
+
+static void setelem (TArray *a, size_t i, lua_Number v) {
+#define SET(T)	elems(a, T)[i] = tofield(T, v)
+  dispatch(a, SET);
+#undef SET
+}
+
+
+static TArray *newarray (lua_State *L, int type, size_t size) {
+  TArray *a;
+  luaL_argcheck(L, size <= ((size_t)~(size_t)0 - sizeof(TArray)) /
+                          typesizes[type], 2, "array too large");
+  a = (TArray *)lua_newuserdata(L,
+                   offsetof(TArray, data) + size * typesizes[type]);
+  a->size = size;
+  a->type = type;
+  memset(a->data.b, 0, size * typesizes[type]);
+  luaL_getmetatable(L, LUA_ARRAYHANDLE);
+  lua_setmetatable(L, -2);
+  return a;
+}
+
+
+/*
+** reads an optional range [i, j] of `a' starting at argument `arg';
+** returns its first position (0-based) and sets `n' to its length
+*/
+static size_t getrange (lua_State *L, const TArray *a, int arg, size_t *n) {
+  lua_Integer i = luaL_optinteger(L, arg, 1);
+  lua_Integer j = luaL_optinteger(L, arg + 1, (lua_Integer)a->size);
+  luaL_argcheck(L, 1 <= i, arg, "position out of range");
+  luaL_argcheck(L, j <= (lua_Integer)a->size, arg + 1,
+                "position out of range");
+  if (i > j) {  /* empty range? */
+    *n = 0;
+    return 0;
+  }
+  *n = (size_t)(j - i + 1);
+  return (size_t)(i - 1);
+}
+
+
+static int arr_new (lua_State *L) {
+  int type = luaL_checkoption(L, 1, NULL, typenames);
+  if (lua_istable(L, 2)) {
+    size_t i, n = lua_objlen(L, 2);
+    TArray *a = newarray(L, type, n);
+    for (i = 0; i < n; i++) {
+      lua_rawgeti(L, 2, (int)(i + 1));
+      if (!lua_isnumber(L, -1))
+        luaL_error(L, "invalid value (at index %d) in table for "
+                      LUA_QL("new"), (int)(i + 1));
+      setelem(a, i, lua_tonumber(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+  else {
+    lua_Integer n = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, n >= 0, 2, "invalid size");
+    newarray(L, type, (size_t)n);
+  }
+  return 1;
+}
+
+
+static int arr_type (lua_State *L) {
+  void *ud;
+  luaL_checkany(L, 1);
+  ud = lua_touserdata(L, 1);
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_ARRAYHANDLE);
+  if (ud == NULL || !lua_getmetatable(L, 1) || !lua_rawequal(L, -2, -1))
+    lua_pushnil(L);  /* not an array */
+  else
+    lua_pushstring(L, typenames[((TArray *)ud)->type]);
+  return 1;
+}
+
+
+static int arr_fill (lua_State *L) {
+  TArray *a = toarray(L, 1);
+  lua_Number v = luaL_checknumber(L, 2);
+  size_t k, n;
+  size_t i = getrange(L, a, 3, &n);
+#define FILL(T) { \
+    T *p = elems(a, T) + i; T x = tofield(T, v); \
+    for (k = 0; k < n; k++) p[k] = x; }
+  dispatch(a, FILL);
+#undef FILL
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** dst:copy(src [, i [, j [, d]]]) copies src[i..j] into dst[d..]
+*/
+static int arr_copy (lua_State *L) {
+  TArray *dst = toarray(L, 1);
+  TArray *src = toarray(L, 2);
+  size_t n, k;
+  size_t i = getrange(L, src, 3, &n);
+  lua_Integer d = luaL_optinteger(L, 5, 1);
+  luaL_argcheck(L, 1 <= d && n <= dst->size &&
+                   (size_t)(d - 1) <= dst->size - n, 5,
+                   "destination out of range");
+  if (src->type == dst->type)
+    memmove(dst->data.b + (size_t)(d - 1) * typesizes[dst->type],
+            src->data.b + i * typesizes[src->type],
+            n * typesizes[src->type]);
+  else {  /* convert each element (arrays are different objects) */
+    for (k = 0; k < n; k++)
+      setelem(dst, (size_t)(d - 1) + k, getelem(src, i + k));
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_slice (lua_State *L) {
+  TArray *a = toarray(L, 1);
+  size_t n;
+  size_t i = getrange(L, a, 2, &n);
+  TArray *b = newarray(L, a->type, n);
+  memcpy(b->data.b, a->data.b + i * typesizes[a->type],
+         n * typesizes[a->type]);
+  return 1;
+}
+
+
+static int arr_totable (lua_State *L) {
+  TArray *a = toarray(L, 1);
+  size_t k, n;
+  size_t i = getrange(L, a, 2, &n);
+  luaL_argcheck(L, n <= (size_t)(~0u >> 1), 1, "array too large");
+  lua_createtable(L, (int)n, 0);
+  for (k = 0; k < n; k++) {
+    lua_pushnumber(L, getelem(a, i + k));
+    lua_rawseti(L, -2, (int)(k + 1));
+  }
+  return 1;
+}
+
+
+static int arr_sum (lua_State *L) {
+  TArray *a = toarray(L, 1);
+  lua_Number s = 0;
+  size_t k, n;
+  size_t i = getrange(L, a, 2, &n);
+#define SUM(T) { \
+    const T *p = elems(a, T) + i; \
+    for (k = 0; k < n; k++) s += (lua_Number)p[k]; }
+  dispatch(a, SUM);
+#undef SUM
+  lua_pushnumber(L, s);
+  return 1;
+}
+
+
+static int minmax (lua_State *L, int max) {
+  TArray *a = toarray(L, 1);
+  lua_Number m = 0;
+  size_t k, n;
+  size_t i = getrange(L, a, 2, &n);
+  if (n == 0) {
+    lua_pushnil(L);  /* empty range has no extreme */
+    return 1;
+  }
+#define MINMAX(T) { \
+    const T *p = elems(a, T) + i; \
+    T x = p[0]; \
+    if (max) { for (k = 1; k < n; k++) if (p[k] > x) x = p[k]; } \
+    else { for (k = 1; k < n; k++) if (p[k] < x) x = p[k]; } \
+    m = (lua_Number)x; }
+  dispatch(a, MINMAX);
+#undef MINMAX
+  lua_pushnumber(L, m);
+  return 1;
+}
+
+
+static int arr_min (lua_State *L) {
+  return minmax(L, 0);
+}
+
+
+static int arr_max (lua_State *L) {
+  return minmax(L, 1);
+}
+
+
+static int arr_dot (lua_State *L) {
+  TArray *a = toarray(L, 1);
+  TArray *b = toarray(L, 2);
+  lua_Number s = 0;
+  size_t k, n = a->size;
+  luaL_argcheck(L, b->size == n, 2, "arrays have different sizes");
+  if (a->type == b->type) {
+#define DOT(T) { \
+      const T *p = elems(a, T); const T *q = elems(b, T); \
+      for (k = 0; k < n; k++) s += (lua_Number)p[k] * (lua_Number)q[k]; }
+    dispatch(a, DOT);
+#undef DOT
+  }
+  else {
+    for (k = 0; k < n; k++)
+      s += getelem(a, k) * getelem(b, k);
+  }
+  lua_pushnumber(L, s);
+  return 1;
+}
+
+
+static int arr_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)toarray(L, 1)->size);
+  return 1;
+}
+
+
+static int arr_tostring (lua_State *L) {
+  TArray *a = toarray(L, 1);
+  lua_pushfstring(L, "array<%s> (%d): %p", typenames[a->type],
+                  (int)a->size, (void *)a);
+  return 1;
+}
+
+
+/*
+** position of index `k' in `a', or -1 when out of range (or not an
+** integer)
+*/
+static lua_Integer getindex (lua_State *L, const TArray *a, int k) {
+  lua_Number n = lua_tonumber(L, k);
+  lua_Integer i = tointeger(n);
+  if ((lua_Number)i != n || i < 1 || (lua_Number)i > (lua_Number)a->size)
+    return -1;
+  return i - 1;
+}
+
+
+static int arr_index (lua_State *L) {
+  TArray *a = toarray(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = getindex(L, a, 2);
+    if (i < 0)
+      lua_pushnil(L);
+    else
+      lua_pushnumber(L, getelem(a, (size_t)i));
+  }
+  else {  /* method */
+    lua_settop(L, 2);
+    lua_gettable(L, lua_upvalueindex(1));
+  }
+  return 1;
+}
+
+
+static int arr_newindex (lua_State *L) {
+  TArray *a = toarray(L, 1);
+  lua_Integer i = getindex(L, a, 2);
+  lua_Number v = luaL_checknumber(L, 3);
+  luaL_argcheck(L, lua_type(L, 2) == LUA_TNUMBER && i >= 0, 2,
+                "index out of range");
+  setelem(a, (size_t)i, v);
+  return 0;
+}
+
+
+static const luaL_Reg methods[] = {
+  {"copy", arr_copy},
+  {"dot", arr_dot},
+  {"fill", arr_fill},
+  {"max", arr_max},
+  {"min", arr_min},
+  {"slice", arr_slice},
+  {"sum", arr_sum},
+  {"totable", arr_totable},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg arraylib[] = {
+  {"copy", arr_copy},
+  {"dot", arr_dot},
+  {"fill", arr_fill},
+  {"max", arr_max},
+  {"min", arr_min},
+  {"new", arr_new},
+  {"slice", arr_slice},
+  {"sum", arr_sum},
+  {"totable", arr_totable},
+  {"type", arr_type},
+  {NULL, NULL}
+};
+
+
+static void createarraymeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_ARRAYHANDLE);  /* create metatable for arrays */
+  lua_newtable(L);  /* methods */
+  luaL_register(L, NULL, methods);
+  lua_pushcclosure(L, arr_index, 1);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, arr_newindex);
+  lua_setfield(L, -2, "__newindex");
+  lua_pushcfunction(L, arr_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, arr_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pop(L, 1);
+}
+
+
+/*
+** Open array library
+*/
+LUALIB_API int luaopen_array (lua_State *L) {
+  createarraymeta(L);
+  luaL_register(L, LUA_ARRAYLIBNAME, arraylib);
+  return 1;
+}
+
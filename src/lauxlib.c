@@ -677,9 +677,62 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Large-object space
+** =======================================================
+*/
+
+#if defined(LUAI_LARGEOBJECT)
+
+#define islarge(s)	((s) >= LUAI_LARGEOBJECT)
+
+#define pageround(s,p)	(((s) + (p) - 1) & ~((p) - 1))
+
+
+/*
+** Blocks of at least LUAI_LARGEOBJECT bytes are mapped directly from the
+** system and unmapped as soon as they are freed. Lua always gives the
+** old size of a block, so its size alone tells how it was allocated.
+*/
+static void *l_largealloc (void *ptr, size_t osize, size_t nsize) {
+  void *nptr;
+  if (nsize == 0) {  /* free a large block */
+    lua_largeunmap(ptr, osize);
+    return NULL;
+  }
+  if (islarge(osize) && islarge(nsize)) {
+    size_t page = lua_largepagesize;
+    size_t op = pageround(osize, page);
+    size_t np = pageround(nsize, page);
+    if (np == op)  /* still fits in its pages? */
+      return ptr;
+    else if (np < op) {  /* shrink in place */
+      lua_largeunmap((char *)ptr + np, op - np);
+      return ptr;
+    }
+  }
+  nptr = islarge(nsize) ? lua_largemap(nsize) : malloc(nsize);
+  if (nptr != NULL && ptr != NULL) {  /* move old contents */
+    memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+    if (islarge(osize)) lua_largeunmap(ptr, osize);
+    else free(ptr);
+  }
+  return nptr;
+}
+
+#endif
+
+/* }====================================================== */
+
+
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   (void)ud;
   (void)osize;
+#if defined(LUAI_LARGEOBJECT)
+  if (islarge(osize) || islarge(nsize))
+    return l_largealloc(ptr, osize, nsize);
+#endif
   if (nsize == 0) {
     free(ptr);
     return NULL;
@@ -689,6 +742,178 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
 }
 
 
+/*
+** {======================================================
+** Pooled allocator
+** =======================================================
+*/
+
+#if defined(LUAI_POOLMAX)
+
+#define POOLALIGN	sizeof(LUAI_USER_ALIGNMENT_T)
+#define NPOOLCLASSES	((LUAI_POOLMAX + POOLALIGN - 1) / POOLALIGN)
+
+#define ispooled(s)	((s) > 0 && (s) <= LUAI_POOLMAX)
+#define poolclass(s)	(((s) - 1) / POOLALIGN)
+#define classsize(c)	(((c) + 1) * POOLALIGN)
+
+
+typedef union PoolSlab {
+  union PoolSlab *next;
+  LUAI_USER_ALIGNMENT_T dummy;  /* blocks after the header are aligned */
+} PoolSlab;
+
+
+/* header of blocks too large for the pools, in arena mode */
+typedef union PoolBig {
+  struct {
+    union PoolBig *prev, *next;
+    size_t size;
+  } l;
+  LUAI_USER_ALIGNMENT_T dummy;
+} PoolBig;
+
+
+typedef struct Pool {
+  void *freelist[NPOOLCLASSES];  /* free blocks of each size class */
+  PoolSlab *slabs;  /* list of all slabs */
+  PoolBig *big;  /* list of large blocks (arena mode only) */
+  int arena;  /* track large blocks too? */
+  size_t inuse;  /* bytes currently given to Lua */
+  int *released;  /* to signal that the pool is gone */
+} Pool;
+
+
+static void *poolget (Pool *p, size_t c) {
+  void *b = p->freelist[c];
+  if (b == NULL) {  /* cut a new slab into blocks of class `c' */
+    size_t bsize = classsize(c);
+    size_t n = LUAI_POOLSLAB / bsize;
+    PoolSlab *s = (PoolSlab *)malloc(sizeof(PoolSlab) + n * bsize);
+    char *blk;
+    if (s == NULL) return NULL;
+    s->next = p->slabs;
+    p->slabs = s;
+    blk = (char *)(s + 1) + n * bsize;
+    while (n--) {
+      blk -= bsize;
+      *(void **)blk = b;
+      b = blk;
+    }
+  }
+  p->freelist[c] = *(void **)b;
+  return b;
+}
+
+
+static void poolput (Pool *p, void *b, size_t c) {
+  *(void **)b = p->freelist[c];
+  p->freelist[c] = b;
+}
+
+
+static void biglink (Pool *p, PoolBig *b, size_t size) {
+  b->l.size = size;
+  b->l.prev = NULL;
+  b->l.next = p->big;
+  if (p->big) p->big->l.prev = b;
+  p->big = b;
+}
+
+
+static void bigunlink (Pool *p, PoolBig *b) {
+  if (b->l.prev) b->l.prev->l.next = b->l.next;
+  else p->big = b->l.next;
+  if (b->l.next) b->l.next->l.prev = b->l.prev;
+}
+
+
+/*
+** Blocks too large for the pools. An arena keeps them in a list, so that
+** it can free them without help from Lua.
+*/
+static void *poolbig (Pool *p, void *ptr, size_t osize, size_t nsize) {
+  PoolBig *b, *nb;
+  if (!p->arena)
+    return l_alloc(NULL, ptr, osize, nsize);
+  b = (ptr == NULL) ? NULL : (PoolBig *)ptr - 1;
+  if (b != NULL) bigunlink(p, b);
+  if (nsize == 0) {
+    if (b != NULL) l_alloc(NULL, b, osize + sizeof(PoolBig), 0);
+    return NULL;
+  }
+  nb = (PoolBig *)l_alloc(NULL, b, (b == NULL) ? 0 : osize + sizeof(PoolBig),
+                          nsize + sizeof(PoolBig));
+  if (nb == NULL) {  /* keep old block */
+    if (b != NULL) biglink(p, b, osize);
+    return NULL;
+  }
+  biglink(p, nb, nsize);
+  return nb + 1;
+}
+
+
+static void poolrelease (Pool *p) {
+  while (p->slabs != NULL) {
+    PoolSlab *s = p->slabs;
+    p->slabs = s->next;
+    free(s);
+  }
+  while (p->big != NULL) {
+    PoolBig *b = p->big;
+    p->big = b->l.next;
+    l_alloc(NULL, b, b->l.size + sizeof(PoolBig), 0);
+  }
+  if (p->released) *p->released = 1;
+  free(p);
+}
+
+
+/*
+** Small blocks come from per-class free lists. Lua always gives the old
+** size of a block, so blocks carry no header: the size picks the class.
+** The state block is the first to be allocated and the last to be freed,
+** so when nothing is in use any more the state is closed and the pool
+** releases its slabs.
+*/
+static void *l_poolalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  void *nptr;
+  if (ispooled(osize) && ispooled(nsize) &&
+      poolclass(osize) == poolclass(nsize))
+    nptr = ptr;  /* still fits its block */
+  else if (!ispooled(osize) && !ispooled(nsize))
+    nptr = poolbig(p, ptr, osize, nsize);
+  else {
+    nptr = ispooled(nsize) ? poolget(p, poolclass(nsize))
+                           : poolbig(p, NULL, 0, nsize);
+    if (nptr == NULL && nsize > 0)
+      return NULL;  /* keep old block */
+    if (ptr != NULL) {
+      if (nptr != NULL)
+        memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+      if (ispooled(osize)) poolput(p, ptr, poolclass(osize));
+      else poolbig(p, ptr, osize, 0);
+    }
+  }
+  if (nptr == NULL && nsize > 0)
+    return NULL;
+  p->inuse += nsize - osize;
+  if (p->inuse == 0 && nsize == 0)  /* state closed? */
+    poolrelease(p);
+  return nptr;
+}
+
+
+static void l_poolfreeall (void *ud) {
+  poolrelease((Pool *)ud);
+}
+
+#endif
+
+/* }====================================================== */
+
+
 static int panic (lua_State *L) {
   (void)L;  /* to avoid warnings */
   fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n",
@@ -697,9 +922,68 @@ static int panic (lua_State *L) {
 }
 
 
+/*
+** a seed given in the environment makes string hashes, and so the
+** order of traversals, the same in every run
+*/
+static lua_State *newstate (lua_Alloc f, void *ud) {
+  const char *seed = getenv(LUA_HASHSEED);
+  if (seed == NULL)
+    return lua_newstate(f, ud);
+  else
+    return lua_newstateseed(f, ud, (unsigned int)strtoul(seed, NULL, 0));
+}
+
+
 LUALIB_API lua_State* luaL_newstate (void) {
-  lua_State* L = lua_newstate(l_alloc, NULL);
+  lua_State* L = newstate(l_alloc, NULL);
   if (L) lua_atpanic(L, &panic);
   return L;
 }
 
+
+#if defined(LUAI_POOLMAX)
+
+static lua_State *newpoolstate (int arena) {
+  int released = 0;
+  lua_State *L;
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(Pool));
+  p->arena = arena;
+  p->released = &released;
+  L = newstate(l_poolalloc, p);
+  if (L == NULL) {
+    if (!released) poolrelease(p);
+    return NULL;
+  }
+  p->released = NULL;
+  if (arena) lua_setfreeall(L, l_poolfreeall);
+  lua_atpanic(L, &panic);
+  return L;
+}
+
+#endif
+
+
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+#if defined(LUAI_POOLMAX)
+  return newpoolstate(0);
+#else
+  return luaL_newstate();
+#endif
+}
+
+
+/*
+** A state whose memory is all owned by its pool, so that lua_close frees
+** it in bulk instead of collecting each object.
+*/
+LUALIB_API lua_State *luaL_newarenastate (void) {
+#if defined(LUAI_POOLMAX)
+  return newpoolstate(1);
+#else
+  return luaL_newstate();
+#endif
+}
+
@@ -191,21 +191,72 @@ static int luaB_gcinfo (lua_State *L) {
 }
 
 
+static int gcstats (lua_State *L) {
+  static const char *const phasenames[LUA_GCNPHASES] = {
+    "propagate", "atomic", "sweepstring", "sweep", "finalize"};
+  lua_GCStats s;
+  int i;
+  lua_getgcstats(L, &s);
+  lua_createtable(L, 0, 9);
+  lua_pushnumber(L, (lua_Number)s.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushnumber(L, (lua_Number)s.steps);
+  lua_setfield(L, -2, "steps");
+  lua_pushnumber(L, s.steptime);
+  lua_setfield(L, -2, "steptime");
+  lua_pushnumber(L, s.stepmax);
+  lua_setfield(L, -2, "stepmax");
+  lua_pushnumber(L, (lua_Number)s.lastfreed);
+  lua_setfield(L, -2, "lastfreed");
+  lua_pushnumber(L, (lua_Number)s.totalfreed);
+  lua_setfield(L, -2, "totalfreed");
+  lua_createtable(L, 0, LUA_GCNPHASES);  /* seconds per phase */
+  for (i = 0; i < LUA_GCNPHASES; i++) {
+    lua_pushnumber(L, s.phasetime[i]);
+    lua_setfield(L, -2, phasenames[i]);
+  }
+  lua_setfield(L, -2, "phases");
+  lua_createtable(L, LUA_GCNBUCKETS, 0);  /* step-duration histogram */
+  for (i = 0; i < LUA_GCNBUCKETS; i++) {
+    lua_pushnumber(L, (lua_Number)s.stephist[i]);
+    lua_rawseti(L, -2, i+1);
+  }
+  lua_setfield(L, -2, "stephist");
+  lua_createtable(L, 0, LUA_GCNTYPES - LUA_TSTRING);  /* live objects */
+  for (i = LUA_TSTRING; i < LUA_GCNTYPES; i++) {
+    lua_pushnumber(L, (lua_Number)s.census[i]);
+    lua_setfield(L, -2, lua_typename(L, i));
+  }
+  lua_setfield(L, -2, "census");
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul", NULL};
+    "count", "step", "setpause", "setstepmul", "deferfinalizers",
+    "runfinalizers", "setlimit", "limit", "stats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
-    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL};
+    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
+    LUA_GCDEFERFINALIZERS, LUA_GCRUNFINALIZERS, LUA_GCSETLIMIT, LUA_GCLIMIT,
+    -1};
   int o = luaL_checkoption(L, 1, "collect", opts);
-  int ex = luaL_optint(L, 2, 0);
-  int res = lua_gc(L, optsnum[o], ex);
+  int ex;
+  int res;
+  if (optsnum[o] == -1)  /* "stats" is not a 'lua_gc' option */
+    return gcstats(L);
+  if (optsnum[o] == LUA_GCDEFERFINALIZERS && lua_isboolean(L, 2))
+    ex = lua_toboolean(L, 2);  /* a flag (numbers work as in 'lua_gc') */
+  else
+    ex = luaL_optint(L, 2, 0);
+  res = lua_gc(L, optsnum[o], ex);
   switch (optsnum[o]) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: {
+    case LUA_GCSTEP: case LUA_GCDEFERFINALIZERS: {
       lua_pushboolean(L, res);
       return 1;
     }
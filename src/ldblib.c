@@ -26,6 +26,61 @@ static int db_getregistry (lua_State *L) {
 }
 
 
+static int snapwriter (lua_State *L, const void *b, size_t size, void *f) {
+  (void)L;
+  return fwrite(b, 1, size, (FILE *)f) != size;
+}
+
+
+static int db_heapsnapshot (lua_State *L) {
+  const char *fname = luaL_checkstring(L, 1);
+  FILE *f = fopen(fname, "wb");
+  int status;
+  if (f == NULL)
+    return luaL_error(L, "cannot open %s", fname);
+  status = lua_heapsnapshot(L, snapwriter, f);
+  if (fclose(f) != 0 || status != 0)
+    return luaL_error(L, "cannot write %s", fname);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int db_allocprofile (lua_State *L) {
+  lua_pushinteger(L, lua_setallocprofile(L, luaL_checkint(L, 1)));
+  return 1;
+}
+
+
+static int bufwriter (lua_State *L, const void *b, size_t size, void *B) {
+  (void)L;
+  luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+  return 0;
+}
+
+
+static int db_allocreport (lua_State *L) {
+  const char *fname = luaL_optstring(L, 1, NULL);
+  if (fname == NULL) {  /* return the report as a string */
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    lua_dumpallocprofile(L, bufwriter, &b);
+    luaL_pushresult(&b);
+  }
+  else {
+    FILE *f = fopen(fname, "w");
+    int status;
+    if (f == NULL)
+      return luaL_error(L, "cannot open %s", fname);
+    status = lua_dumpallocprofile(L, snapwriter, f);
+    if (fclose(f) != 0 || status != 0)
+      return luaL_error(L, "cannot write %s", fname);
+    lua_pushboolean(L, 1);
+  }
+  return 1;
+}
+
+
 static int db_getmetatable (lua_State *L) {
   luaL_checkany(L, 1);
   if (!lua_getmetatable(L, 1)) {
@@ -373,9 +428,12 @@ static int db_errorfb (lua_State *L) {
 
 
 static const luaL_Reg dblib[] = {
+  {"allocprofile", db_allocprofile},
+  {"allocreport", db_allocreport},
   {"debug", db_debug},
   {"getfenv", db_getfenv},
   {"gethook", db_gethook},
+  {"heapsnapshot", db_heapsnapshot},
   {"getinfo", db_getinfo},
   {"getlocal", db_getlocal},
   {"getregistry", db_getregistry},
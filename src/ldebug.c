@@ -8,6 +8,7 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
 
@@ -637,3 +638,207 @@ void luaG_runerror (lua_State *L, const char *fmt, ...) {
   luaG_errormsg(L);
 }
 
+
+
+
+/*
+** {======================================================
+** Allocation profile
+** =======================================================
+*/
+
+#define ALLOCBUCKETS	1024  /* number of buckets in the profile */
+#define ALLOCSTACK	1024  /* maximum length of a folded stack */
+
+
+/*
+** Bytes allocated from one call stack. The stack is kept folded: frame
+** names from the outermost call to the allocating one, separated by ';',
+** and ending with the type of the object being created.
+*/
+typedef struct AllocSite {
+  struct AllocSite *next;  /* next site in the same bucket */
+  unsigned int h;  /* hash of `stack' */
+  lu_mem bytes;  /* estimated bytes allocated from this stack */
+  size_t len;  /* length of `stack' */
+  char stack[1];
+} AllocSite;
+
+
+/*
+** The profile lives outside the Lua heap (it is allocated directly with
+** `frealloc'), so it neither counts in `totalbytes' nor samples itself.
+*/
+typedef struct AllocProfile {
+  AllocSite *bucket[ALLOCBUCKETS];
+} AllocProfile;
+
+
+static size_t addframe (char *buff, size_t n, const char *frame) {
+  if (n > 0 && n < ALLOCSTACK)
+    buff[n++] = ';';
+  for (; *frame != '\0' && n < ALLOCSTACK; frame++)  /* keep the format */
+    buff[n++] = (*frame == ';' || *frame == '\n') ? '_' : *frame;
+  return n;
+}
+
+
+static void framename (lua_State *L, CallInfo *ci, char *buff) {
+  const char *name;
+  if (getfuncname(L, ci, &name) == NULL)
+    name = NULL;
+  if (isLua(ci)) {
+    char src[LUA_IDSIZE];
+    luaO_chunkid(src, getstr(ci_func(ci)->l.p->source), LUA_IDSIZE);
+    if (name)
+      sprintf(buff, "%.40s@%s:%d", name, src, currentline(L, ci));
+    else
+      sprintf(buff, "%s:%d", src, currentline(L, ci));
+  }
+  else if (name)
+    sprintf(buff, "%.40s@[C]", name);
+  else
+    strcpy(buff, "[C]");
+}
+
+
+static void addsample (global_State *g, const char *stack, size_t len,
+                       lu_mem bytes) {
+  AllocProfile *p = g->allocprof;
+  AllocSite *s;
+  unsigned int h = cast(unsigned int, len);
+  size_t i;
+  for (i = 0; i < len; i++)
+    h = h ^ ((h<<5) + (h>>2) + cast(unsigned char, stack[i]));
+  if (p == NULL) {  /* first sample? */
+    p = cast(AllocProfile *,
+             (*g->frealloc)(g->ud, NULL, 0, sizeof(AllocProfile)));
+    if (p == NULL) return;  /* no memory: drop the sample */
+    for (i = 0; i < ALLOCBUCKETS; i++) p->bucket[i] = NULL;
+    g->allocprof = p;
+  }
+  for (s = p->bucket[h % ALLOCBUCKETS]; s != NULL; s = s->next) {
+    if (s->h == h && s->len == len && memcmp(s->stack, stack, len) == 0) {
+      s->bytes += bytes;
+      return;
+    }
+  }
+  s = cast(AllocSite *,
+           (*g->frealloc)(g->ud, NULL, 0, sizeof(AllocSite) + len));
+  if (s == NULL) return;  /* no memory: drop the sample */
+  s->h = h;
+  s->bytes = bytes;
+  s->len = len;
+  memcpy(s->stack, stack, len);
+  s->next = p->bucket[h % ALLOCBUCKETS];
+  p->bucket[h % ALLOCBUCKETS] = s;
+}
+
+
+/*
+** Called by `luaM_realloc_' (before the block moves, so that the stack
+** is consistent) when `allocnext' runs out. Each sample stands for
+** `allocrate' bytes; a block larger than that counts for several.
+*/
+void luaG_allocsample (lua_State *L, int tt) {
+  global_State *g = G(L);
+  char stack[ALLOCSTACK];
+  char frame[LUA_IDSIZE + 64];
+  size_t n = 0;
+  CallInfo *ci = L->base_ci + 1;
+  lu_mem nsamples = 1 + cast(lu_mem, -g->allocnext) / g->allocrate;
+  g->allocnext += cast(l_mem, nsamples * g->allocrate);
+  if (L->ci - L->base_ci > LUAI_MAXALLOCDEPTH) {  /* too deep? */
+    ci = L->ci - LUAI_MAXALLOCDEPTH + 1;  /* keep only the innermost calls */
+    n = addframe(stack, n, "...");
+  }
+  for (; ci <= L->ci; ci++) {
+    framename(L, ci, frame);
+    n = addframe(stack, n, frame);
+  }
+  if (tt == 0)
+    strcpy(frame, "(other)");
+  else
+    sprintf(frame, "(%s)", luaT_typenames[tt]);
+  n = addframe(stack, n, frame);
+  addsample(g, stack, n, nsamples * g->allocrate);
+}
+
+
+void luaG_freeallocprofile (lua_State *L) {
+  global_State *g = G(L);
+  AllocProfile *p = g->allocprof;
+  int i;
+  if (p == NULL) return;
+  for (i = 0; i < ALLOCBUCKETS; i++) {
+    AllocSite *s = p->bucket[i];
+    while (s != NULL) {
+      AllocSite *next = s->next;
+      (*g->frealloc)(g->ud, s, sizeof(AllocSite) + s->len, 0);
+      s = next;
+    }
+  }
+  (*g->frealloc)(g->ud, p, sizeof(AllocProfile), 0);
+  g->allocprof = NULL;
+}
+
+
+/*
+** Samples one allocation every `rate' bytes (0 stops sampling). Starting
+** a profile discards the samples of the previous one. Returns the old rate.
+*/
+LUA_API int lua_setallocprofile (lua_State *L, int rate) {
+  global_State *g;
+  int old;
+  lua_lock(L);
+  g = G(L);
+  old = g->allocrate;
+  if (rate < 0) rate = 0;
+  if (old == 0 && rate > 0) {  /* starting a new profile? */
+    luaG_freeallocprofile(L);
+    g->allocnext = rate;
+  }
+  else if (g->allocnext > rate)
+    g->allocnext = rate;
+  g->allocrate = rate;
+  lua_unlock(L);
+  return old;
+}
+
+
+/*
+** Writes the profile in the folded-stack format read by flame-graph
+** tools: one line "frame;frame;...;(type) bytes" per call stack.
+** Sampling is suspended while the writer runs; it must not restart the
+** profile.
+*/
+LUA_API int lua_dumpallocprofile (lua_State *L, lua_Writer writer,
+                                  void *data) {
+  global_State *g;
+  AllocProfile *p;
+  int rate;
+  int status = 0;
+  int i;
+  lua_lock(L);
+  g = G(L);
+  p = g->allocprof;
+  rate = g->allocrate;
+  g->allocrate = 0;
+  for (i = 0; p != NULL && i < ALLOCBUCKETS && status == 0; i++) {
+    AllocSite *s;
+    for (s = p->bucket[i]; s != NULL && status == 0; s = s->next) {
+      char num[32];
+      sprintf(num, " %lu\n", cast(unsigned long, s->bytes));
+      lua_unlock(L);
+      status = (*writer)(L, s->stack, s->len, data);
+      if (status == 0)
+        status = (*writer)(L, num, strlen(num), data);
+      lua_lock(L);
+    }
+  }
+  g->allocrate = rate;
+  lua_unlock(L);
+  return status;
+}
+
+/* }====================================================== */
@@ -540,12 +540,13 @@ static void f_parser (lua_State *L, void *ud) {
   // 根据之前预读的数据来决定下面的分析采用哪个函数
   tf = ((c == LUA_SIGNATURE[0]) ? luaU_undump : luaY_parser)(L, p->z,
                                                              &p->buff, p->name);
+  setptvalue2s(L, L->top, tf);  /* anchor prototype while building closure */
+  incr_top(L);
   cl = luaF_newLclosure(L, tf->nups, hvalue(gt(L)));
   cl->l.p = tf;
   for (i = 0; i < tf->nups; i++)  /* initialize eventual upvalues */
     cl->l.upvals[i] = luaF_newupval(L);
-  setclvalue(L, L->top, cl);
-  incr_top(L);
+  setclvalue(L, L->top - 1, cl);
 }
 
 
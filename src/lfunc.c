@@ -22,7 +22,8 @@
 
 
 Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e) {
-  Closure *c = cast(Closure *, luaM_malloc(L, sizeCclosure(nelems)));
+  Closure *c = cast(Closure *, luaM_newobject(L, LUA_TFUNCTION,
+                                               sizeCclosure(nelems)));
   luaC_link(L, obj2gco(c), LUA_TFUNCTION);
   c->c.isC = 1;
   c->c.env = e;
@@ -32,7 +33,8 @@ Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e) {
 
 // 创建一个lua函数调用, nelems是该函数的upval数量
 Closure *luaF_newLclosure (lua_State *L, int nelems, Table *e) {
-  Closure *c = cast(Closure *, luaM_malloc(L, sizeLclosure(nelems)));
+  Closure *c = cast(Closure *, luaM_newobject(L, LUA_TFUNCTION,
+                                               sizeLclosure(nelems)));
   luaC_link(L, obj2gco(c), LUA_TFUNCTION);
   c->l.isC = 0;
   c->l.env = e;
@@ -44,7 +46,7 @@ Closure *luaF_newLclosure (lua_State *L, int nelems, Table *e) {
 
 
 UpVal *luaF_newupval (lua_State *L) {
-  UpVal *uv = luaM_new(L, UpVal);
+  UpVal *uv = cast(UpVal *, luaM_newobject(L, LUA_TUPVAL, sizeof(UpVal)));
   luaC_link(L, obj2gco(uv), LUA_TUPVAL);
   // 初始时uv->v指向uv->u.value（此时是closed状态）
   uv->v = &uv->u.value;
@@ -63,11 +65,13 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
     if (p->v == level) {  /* found a corresponding upvalue? */
       if (isdead(g, obj2gco(p)))  /* is it dead? */
         changewhite(obj2gco(p));  /* ressurect it */
+      luaC_recent(g, obj2gco(p));
       return p;
     }
     pp = &p->next;
   }
-  uv = luaM_new(L, UpVal);  /* not found: create a new one */
+  /* not found: create a new one */
+  uv = cast(UpVal *, luaM_newobject(L, LUA_TUPVAL, sizeof(UpVal)));
   uv->tt = LUA_TUPVAL;
   uv->marked = luaC_white(g);
   // 有值则指向level（此时是open状态）
@@ -79,6 +83,7 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
   uv->u.l.next->u.l.prev = uv;
   g->uvhead.u.l.next = uv;
   lua_assert(uv->u.l.next->u.l.prev == uv && uv->u.l.prev->u.l.next == uv);
+  luaC_recent(g, obj2gco(uv));
   return uv;
 }
 
@@ -123,7 +128,7 @@ void luaF_close (lua_State *L, StkId level) {
 
 
 Proto *luaF_newproto (lua_State *L) {
-  Proto *f = luaM_new(L, Proto);
+  Proto *f = cast(Proto *, luaM_newobject(L, LUA_TPROTO, sizeof(Proto)));
   luaC_link(L, obj2gco(f), LUA_TPROTO);
   f->k = NULL;
   f->sizek = 0;
@@ -4,6 +4,7 @@
 ** See Copyright Notice in lua.h
 */
 
+#include <stdio.h>
 #include <string.h>
 
 #define lgc_c
@@ -26,6 +27,7 @@
 #define GCSTEPSIZE	1024u
 #define GCSWEEPMAX	40
 #define GCSWEEPCOST	10
+#define GCMIGRATEMAX	64
 #define GCFINALIZECOST	100
 
 // 除了黑白色之外的位值
@@ -62,6 +64,12 @@
 // 设置触发GC的阈值：estimate的值的某个百分比，这个百分比由gcpause参数控制
 #define setthreshold(g)  (g->GCthreshold = (g->estimate/100) * g->gcpause)
 
+/* statistics phase of a collector state ('markroot' counts as propagate;
+   the other phases are numbered like the states, see lua.h) */
+#define gcphase(s)	((s) <= GCSpropagate ? LUA_GCPPROPAGATE : (s))
+
+#define resetcensus(g)	memset((g)->gccensus, 0, sizeof((g)->gccensus))
+
 
 static void removeentry (Node *n) {
   lua_assert(ttisnil(gval(n)));
@@ -173,6 +181,75 @@ size_t luaC_separateudata (lua_State *L, int all) {
   return deadmem;
 }
 
+#define linktable(h,l)	{ (h)->gclist = (l); (l) = obj2gco(h); }
+
+
+/*
+** An entry of a weak table whose key is white. Strings are `values',
+** so they are marked here and never count as white keys.
+*/
+static int iswhitekey (const TValue *k) {
+  if (!iscollectable(k)) return 0;
+  if (ttisstring(k)) {
+    stringmark(rawtsvalue(k));
+    return 0;
+  }
+  return iswhite(gcvalue(k));
+}
+
+
+/*
+** Traverse an ephemeron table (weak keys, strong values): a value is
+** marked only once its key is known to be alive. Tables with entries
+** `white key -> white value' go to 'ephemeron' to be revisited by
+** 'convergeephemerons'; the others go to 'allweak', to be cleared only.
+** Returns 1 if some value was marked.
+*/
+static int traverseephemeron (global_State *g, Table *h) {
+  int marked = 0;  /* true if an object is marked in this traversal */
+  int prop = 0;  /* true if table has entry `white key -> white value' */
+  int i = h->sizearray;
+  while (i--) {  /* integer keys are never white */
+    if (valiswhite(&h->array[i])) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->array[i]));
+    }
+  }
+  i = h->shape->nslots;
+  while (i--) {  /* neither are strings */
+    if (valiswhite(&h->slots[i])) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->slots[i]));
+    }
+  }
+  i = sizenode(h);
+  while (i--) {
+    Node *n = gnode(h, i);
+    lua_assert(ttype(gkey(n)) != LUA_TDEADKEY || ttisnil(gval(n)));
+    if (ttisnil(gval(n)))
+      removeentry(n);  /* remove empty entries */
+    else if (iswhitekey(key2tval(n))) {  /* key not marked (yet)? */
+      if (valiswhite(gval(n)))
+        prop = 1;  /* value may be marked later, if the key is */
+    }
+    else if (valiswhite(gval(n))) {  /* key alive: value is strong */
+      marked = 1;
+      reallymarkobject(g, gcvalue(gval(n)));
+    }
+  }
+  if (prop)
+    linktable(h, g->ephemeron)  /* have to propagate again */
+  else
+    linktable(h, g->allweak)  /* may have to clean white keys */
+  return marked;
+}
+
+
+/*
+** Traverse a table. Weak tables end up black but linked in one of the
+** weak lists; 'luaC_barrierback' only turns them gray again, so that
+** 'atomic' re-traverses just the weak tables changed since.
+*/
 // 遍历一个表, 返回1表示是弱表
 static int traversetable (global_State *g, Table *h) {
   int i;
@@ -182,34 +259,37 @@ static int traversetable (global_State *g, Table *h) {
   // markmeta表
   if (h->metatable)
     markobject(g, h->metatable);
+  h->shape->marked = 1;  /* keep its shape */
+  // 首先将原来的弱键/弱值标记位清除
+  h->marked &= ~(KEYWEAK | VALUEWEAK);  /* clear bits */
   mode = gfasttm(g, h->metatable, TM_MODE);
   // 如果__mode元方法被定义
   if (mode && ttisstring(mode)) {  /* is there a weak mode? */
 	  // 判断是弱键还是弱值
-    weakkey = (strchr(svalue(mode), 'k') != NULL);
-    weakvalue = (strchr(svalue(mode), 'v') != NULL);
-    if (weakkey || weakvalue) {  /* is really weak? */
-      // 如果其中之一的条件满足
-      // 首先将原来的弱键/弱值标记位清除
-      h->marked &= ~(KEYWEAK | VALUEWEAK);  /* clear bits */
-      // 标记这次的标记位
-      h->marked |= cast_byte((weakkey << KEYWEAKBIT) |
-                             (weakvalue << VALUEWEAKBIT));
-      // 加入weak链表中
-      h->gclist = g->weak;  /* must be cleared after GC, ... */
-      g->weak = obj2gco(h);  /* ... so put in the appropriate list */
-    }
-  }
-  // 如果既是弱值也是弱键直接返回了，表中的数据都不需要进行标记
-  if (weakkey && weakvalue) return 1;
+    weakkey = (memchr(svalue(mode), 'k', tsvalue(mode)->len) != NULL);
+    weakvalue = (memchr(svalue(mode), 'v', tsvalue(mode)->len) != NULL);
+    // 标记这次的标记位
+    h->marked |= cast_byte((weakkey << KEYWEAKBIT) |
+                           (weakvalue << VALUEWEAKBIT));
+  }
+  if (weakkey && weakvalue) {  /* nothing to mark */
+    linktable(h, g->allweak);
+    return 1;
+  }
+  if (weakkey) {  /* ephemeron */
+    traverseephemeron(g, h);
+    return 1;
+  }
   // 如果不是弱值，那么需要mark所有的数组值
   if (!weakvalue) {
     i = h->sizearray;
     // 把所有数组的值都mark
     while (i--)
       markvalue(g, &h->array[i]);
+    i = h->shape->nslots;
+    while (i--)
+      markvalue(g, &h->slots[i]);
   }
-  // 无论是弱值还是弱key都需要做这一步:遍历hash部分,根据是弱值/key来标记key/值
   i = sizenode(h);
   while (i--) {
     Node *n = gnode(h, i);
@@ -219,12 +299,13 @@ static int traversetable (global_State *g, Table *h) {
       removeentry(n);  /* remove empty entries */
     else {
       lua_assert(!ttisnil(gkey(n)));
-      // 分别视到底是弱值还是弱键情况mark值和键
-      if (!weakkey) markvalue(g, gkey(n));
+      markvalue(g, gkey(n));
       if (!weakvalue) markvalue(g, gval(n));
     }
   }
-  return weakkey || weakvalue;
+  if (weakvalue)
+    linktable(h, g->weak)  /* must be cleared after GC */
+  return weakvalue;
 }
 
 
@@ -272,8 +353,10 @@ static void traverseclosure (global_State *g, Closure *cl) {
     int i;
     lua_assert(cl->l.nupvalues == cl->l.p->nups);
     markobject(g, cl->l.p);
-    for (i=0; i<cl->l.nupvalues; i++)  /* mark its upvalues */
-      markobject(g, cl->l.upvals[i]);
+    for (i=0; i<cl->l.nupvalues; i++) {  /* mark its upvalues */
+      if (cl->l.upvals[i] != NULL)  /* closure may still be being built */
+        markobject(g, cl->l.upvals[i]);
+    }
   }
 }
 
@@ -293,20 +376,30 @@ static void checkstacksizes (lua_State *L, StkId max) {
 }
 
 
+/*
+** An emergency collection runs inside an allocation, where the
+** interpreter may still use registers above `top'; those of Lua frames
+** (cleared when the frame starts, so never left over from older frames)
+** are marked instead of cleared.
+*/
 static void traversestack (global_State *g, lua_State *l) {
-  StkId o, lim;
+  StkId o, lim, keep;
   CallInfo *ci;
   markvalue(g, gt(l));
-  lim = l->top;
+  if (l->stack == NULL)  /* stack not built yet? */
+    return;
+  lim = keep = l->top;
   for (ci = l->base_ci; ci <= l->ci; ci++) {
     lua_assert(ci->top <= l->stack_last);
     if (lim < ci->top) lim = ci->top;
+    if (g->gcemergency && keep < ci->top && isLua(ci)) keep = ci->top;
   }
-  for (o = l->stack; o < l->top; o++)
+  for (o = l->stack; o < keep; o++)
     markvalue(g, o);
-  for (; o <= lim; o++)
+  for (; o <= lim; o++)  /* clear dead registers: they are not marked */
     setnilvalue(o);
-  checkstacksizes(l, lim);
+  if (!g->gcemergency)  /* cannot move the stack inside an allocation */
+    checkstacksizes(l, lim);
 }
 
 
@@ -325,11 +418,8 @@ static l_mem propagatemark (global_State *g) {
     case LUA_TTABLE: {
       Table *h = gco2h(o);
       g->gray = h->gclist;
-      // 如果是弱表,变回到灰色----这又是为什么呢?
-      if (traversetable(g, h))  /* table is weak? */
-        black2gray(o);  /* keep it gray */
-      return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                             sizeof(Node) * sizenode(h);
+      traversetable(g, h);
+      return luaH_bytes(h);
     }
     case LUA_TFUNCTION: {
       Closure *cl = gco2cl(o);
@@ -411,6 +501,12 @@ static void cleartable (GCObject *l) {
         if (iscleared(o, 0))  /* value was collected? */
           setnilvalue(o);  /* remove value */
       }
+      i = h->shape->nslots;
+      while (i--) {  /* string keys are never cleared */
+        TValue *o = &h->slots[i];
+        if (iscleared(o, 0))
+          setnilvalue(o);
+      }
     }
     i = sizenode(h);
     while (i--) {
@@ -430,6 +526,19 @@ static void cleartable (GCObject *l) {
   }
 }
 
+
+/*
+** the cache of strings of integers does not keep its strings alive
+*/
+static void clearnumcache (global_State *g) {
+  int i;
+  for (i = 0; i < LUAI_NUMCACHE; i++) {
+    TString *ts = g->numcache[i].s;
+    if (ts != NULL && iswhite(obj2gco(ts)))  /* string was collected? */
+      g->numcache[i].s = NULL;
+  }
+}
+
 // 根据类型删除一个object
 static void freeobj (lua_State *L, GCObject *o) {
   switch (o->gch.tt) {
@@ -443,7 +552,10 @@ static void freeobj (lua_State *L, GCObject *o) {
       break;
     }
     case LUA_TSTRING: {
-      G(L)->strt.nuse--;
+      if (isrope(rawgco2ts(o)))
+        luaS_freerope(L, rawgco2ts(o));
+      else if (isshortstr(rawgco2ts(o)))
+        G(L)->strt.nuse--;
       luaM_freemem(L, o, sizestring(gco2ts(o)));
       break;
     }
@@ -474,6 +586,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
       // 也就是说,这个对象本次不会去回收
       lua_assert(!isdead(g, curr) || testbit(curr->gch.marked, FIXEDBIT));
       makewhite(g, curr);  /* make it white (for next cycle) */
+      g->gccensus[curr->gch.tt]++;
       p = &curr->gch.next;
     }
     else {  /* must erase `curr' */
@@ -489,14 +602,26 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
 }
 
 
+static void shrinkstrt (lua_State *L, void *ud) {
+  UNUSED(ud);
+  luaS_resize(L, G(L)->strt.size/2);
+}
+
+
 static void checkSizes (lua_State *L) {
   global_State *g = G(L);
+  if (g->gcemergency)  /* string table or buffer may be in use */
+    return;
   /* check size of string hash */
   if (g->strt.nuse < cast(lu_int32, g->strt.size/4) &&
-      g->strt.size > MINSTRTABSIZE*2)
+      g->strt.size > MINSTRTABSIZE*2) {
     // 字符串的数量小于桶数组数量的1/4，同时还大于最低要求的hash桶数量两倍时
     // 此时桶数组就太大，有点浪费了，于是这里将桶大小减一倍
-    luaS_resize(L, g->strt.size/2);  /* table is too big */
+    g->gcemergency = 1;  /* no emergency collection inside the collector */
+    /* table is too big; if the new one cannot be allocated, keep the old */
+    luaD_rawrunprotected(L, shrinkstrt, NULL);
+    g->gcemergency = 0;
+  }
   /* check size of buffer */
   if (luaZ_sizebuffer(&g->buff) > LUA_MINBUFFER*2) {  /* buffer too big? */
     size_t newsize = luaZ_sizebuffer(&g->buff) / 2;
@@ -522,6 +647,10 @@ static void GCTM (lua_State *L) {
   // 这里为什么要变成白色呢?也就是下一次GC才回收
   // 换言之,udata的GC方法是这一次被调用,但是udata本身是下一次才回收
   makewhite(g, o);
+  /* drained while marking (see `luaC_runfinalizers')? It was black, so
+     tables may have taken it without a barrier: keep it for this cycle */
+  if (g->gcstate == GCSpropagate)
+    reallymarkobject(g, o);
   tm = fasttm(L, udata->uv.metatable, TM_GC);
   if (tm != NULL) {
 	// 调用GC方法
@@ -547,6 +676,22 @@ void luaC_callGCTM (lua_State *L) {
     GCTM(L);
 }
 
+
+/*
+** Call at most `max' pending GC tag methods (all of them if `max' <= 0),
+** in the order the collector found them. With `gcdeferfin' set the
+** collector leaves them here for the embedder, who may drain them at any
+** point of a cycle. Returns how many were called.
+*/
+int luaC_runfinalizers (lua_State *L, int max) {
+  int n = 0;
+  while (G(L)->tmudata && (max <= 0 || n < max)) {
+    GCTM(L);
+    n++;
+  }
+  return n;
+}
+
 // 全部清除,不管什么颜色
 void luaC_freeall (lua_State *L) {
   global_State *g = G(L);
@@ -554,8 +699,8 @@ void luaC_freeall (lua_State *L) {
   // 两种白色都清除
   g->currentwhite = WHITEBITS | bitmask(SFIXEDBIT);  /* mask to collect all elements */
   sweepwholelist(L, &g->rootgc);
-  for (i = 0; i < g->strt.size; i++)  /* free all string lists */
-    sweepwholelist(L, &g->strt.hash[i]);
+  for (i = 0; i < luaS_nbuckets(&g->strt); i++)  /* free all string lists */
+    sweepwholelist(L, luaS_bucket(&g->strt, i));
 }
 
 
@@ -566,6 +711,36 @@ static void markmt (global_State *g) {
 }
 
 
+/*
+** shapes keep their keys alive; each one marks the key it added, as
+** its parent marks the others
+*/
+static void markshapes (global_State *g) {
+  Shape *s;
+  for (s = g->shaperoot.next; s != NULL; s = s->next)
+    stringmark(s->keys[s->nslots - 1]);
+}
+
+
+/*
+** An emergency collection may run while a new object (or a string just
+** looked up) is held only by a C variable, so it keeps the objects last
+** passed to `luaC_recent'. Other cycles run where everything is
+** anchored; they forget those objects instead, as they may die in the
+** coming sweep.
+*/
+static void markrecent (global_State *g) {
+  int i;
+  for (i=0; i<GCRECENT; i++) {
+    if (g->gcemergency) {
+      if (g->gcrecent[i]) markobject(g, g->gcrecent[i]);
+    }
+    else
+      g->gcrecent[i] = NULL;
+  }
+}
+
+
 /* 标记主线程对象，标记主线程的全局表、注册表，以及为全局类型注册的元表 */
 static void markroot (lua_State *L) {
   global_State *g = G(L);
@@ -573,6 +748,9 @@ static void markroot (lua_State *L) {
   g->gray = NULL;
   g->grayagain = NULL;
   g->weak = NULL;
+  g->ephemeron = NULL;
+  g->allweak = NULL;
+  g->gcfreed = 0;
   markobject(g, g->mainthread);
   /* make global table be traversed before main stack */
   // 标记g表和reg表
@@ -594,6 +772,52 @@ static void remarkupvals (global_State *g) {
   }
 }
 
+/*
+** Re-traverse the tables of a weak list that 'luaC_barrierback' turned
+** gray; the others are already complete and are just linked back.
+*/
+static void retraverseweak (global_State *g, GCObject **list) {
+  GCObject *l = *list;
+  *list = NULL;
+  while (l) {
+    Table *h = gco2h(l);
+    l = h->gclist;
+    if (isgray(obj2gco(h))) {
+      gray2black(obj2gco(h));
+      traversetable(g, h);  /* links 'h' into its list again */
+    }
+    else
+      linktable(h, *list);
+  }
+}
+
+
+/*
+** Traverse the ephemeron tables until no more values are marked:
+** marking a value may make alive the key of another entry.
+** Returns the size of what was marked.
+*/
+static size_t convergeephemerons (global_State *g) {
+  size_t m = 0;
+  int changed;
+  do {
+    GCObject *next = g->ephemeron;
+    g->ephemeron = NULL;
+    changed = 0;
+    while (next) {
+      Table *h = gco2h(next);
+      next = h->gclist;
+      gray2black(obj2gco(h));
+      if (traverseephemeron(g, h)) {  /* marked some value? */
+        m += propagateall(g);
+        changed = 1;
+      }
+    }
+  } while (changed);
+  return m;
+}
+
+
 // 一个原子的过程,不可被中断
 static void atomic (lua_State *L) {
   global_State *g = G(L);
@@ -602,33 +826,82 @@ static void atomic (lua_State *L) {
   remarkupvals(g);
   /* traverse objects cautch by write barrier and by 'remarkupvals' */
   propagateall(g);
-  /* remark weak tables */
-  // 标记弱表
-  g->gray = g->weak;
-  g->weak = NULL;
+  /* remark weak tables changed since their traversal */
+  // 只重新遍历被写屏障变回灰色的弱表
+  retraverseweak(g, &g->weak);
+  retraverseweak(g, &g->allweak);
   lua_assert(!iswhite(obj2gco(g->mainthread)));
   markobject(g, L);  /* mark running thread */
   markmt(g);  /* mark basic metatables (again) */
+  markrecent(g);
   propagateall(g);
   /* remark gray again */
   // 遍历again链表进行标记
   g->gray = g->grayagain;
   g->grayagain = NULL;
   propagateall(g);
+  convergeephemerons(g);
   udsize = luaC_separateudata(L, 0);  /* separate userdata to be finalized */
   /* 需要调用gc方法的这些userdata在当个gc循环是不能被直接清除的。所以在mark环节的最后，会被重新mark位不可清除节点 */
   marktmu(g);  /* mark `preserved' userdata */
   udsize += propagateall(g);  /* remark, to propagate `preserveness' */
+  udsize += convergeephemerons(g);
+  luaH_sweepshapes(L);  /* all live tables have marked their shapes */
+  markshapes(g);
   // 一个原子的过程去mark弱表
   cleartable(g->weak);  /* remove collected objects from weak tables */
+  cleartable(g->ephemeron);
+  cleartable(g->allweak);
+  clearnumcache(g);
   /* flip current white */
   g->currentwhite = cast_byte(otherwhite(g));
   g->sweepstrgc = 0;
   g->sweepgc = &g->rootgc;
+  resetcensus(g);
   g->gcstate = GCSsweepstring;
   g->estimate = g->totalbytes - udsize;  /* first estimate */
 }
 
+
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+/* charge the time elapsed since 'g->gcclock' to phase 'p' */
+static void chargephase (global_State *g, int p) {
+  double now;
+  luai_gcclock(now);
+  g->gcstats.phasetime[p] += now - g->gcclock;
+  g->gcclock = now;
+}
+
+
+static void countfreed (global_State *g, lu_mem freed) {
+  g->gcfreed += freed;
+  g->gcstats.totalfreed += freed;
+}
+
+
+/* record the duration of one 'luaC_step' in the histogram */
+static void countstep (global_State *g, double start) {
+  double t = g->gcclock - start;
+  double us = t * 1e6;
+  int b = 0;
+  if (us >= 1) {
+    b = (us >= twoto(LUA_GCNBUCKETS - 2)) ? LUA_GCNBUCKETS - 1
+                                          : luaO_log2(cast(unsigned int, us)) + 1;
+  }
+  g->gcstats.stephist[b]++;
+  g->gcstats.steps++;
+  g->gcstats.steptime += t;
+  if (t > g->gcstats.stepmax)
+    g->gcstats.stepmax = t;
+}
+
+/* }====================================================== */
+
 // GC状态机的单步工作
 static l_mem singlestep (lua_State *L) {
   global_State *g = G(L);
@@ -644,7 +917,9 @@ static l_mem singlestep (lua_State *L) {
         return propagatemark(g);
       else {  /* no more `gray' objects */
     	  // 再也没有灰色的对象了,来一个原子的mark过程
+        chargephase(g, LUA_GCPPROPAGATE);
         atomic(L);  /* finish mark phase */
+        chargephase(g, LUA_GCPATOMIC);
         return 0;
       }
     }
@@ -653,11 +928,13 @@ static l_mem singlestep (lua_State *L) {
       // 首先保存旧的总大小
       lu_mem old = g->totalbytes;
       // 对某个string的hash table进行回收
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
+      sweepwholelist(L, luaS_bucket(&g->strt, g->sweepstrgc));
+      g->sweepstrgc++;
       // 如果已经回收完了，进入下一个阶段GCSsweep
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      if (g->sweepstrgc >= luaS_nbuckets(&g->strt))  /* nothing more to sweep? */
         g->gcstate = GCSsweep;  /* end sweep-string phase */
       lua_assert(old >= g->totalbytes);
+      countfreed(g, old - g->totalbytes);
       // 减少估值
       g->estimate -= old - g->totalbytes;
       // 我猜想这里返回一个固定的值，而不是按照实际回收的大小返回
@@ -667,18 +944,28 @@ static l_mem singlestep (lua_State *L) {
     case GCSsweep: {
       lu_mem old = g->totalbytes;
       g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
+      lua_assert(old >= g->totalbytes);
+      countfreed(g, old - g->totalbytes);
+      g->estimate -= old - g->totalbytes;
       if (*g->sweepgc == NULL) {  /* nothing more to sweep? */
-        checkSizes(L);
+        old = g->totalbytes;
+        checkSizes(L);  /* (a smaller string table is allocated first) */
+        if (old > g->totalbytes) {
+          countfreed(g, old - g->totalbytes);
+          g->estimate -= old - g->totalbytes;
+        }
+        else
+          g->estimate += g->totalbytes - old;
+        memcpy(g->gcstats.census, g->gccensus, sizeof(g->gccensus));
         g->gcstate = GCSfinalize;  /* end sweep phase */
       }
-      lua_assert(old >= g->totalbytes);
-      g->estimate -= old - g->totalbytes;
       // 我猜想这里返回一个固定的值，而不是按照实际回收的大小返回
       // 是因为前面扫描阶段已经返回实际的值了？
       return GCSWEEPMAX*GCSWEEPCOST;
     }
     case GCSfinalize: {
-      if (g->tmudata) {
+      // 延迟模式下gc方法留给LUA_GCRUNFINALIZERS调用,tmudata留到下一轮
+      if (g->tmudata && !g->gcdeferfin && !g->gcemergency) {
         GCTM(L);
         if (g->estimate > GCFINALIZECOST)
           g->estimate -= GCFINALIZECOST;
@@ -687,6 +974,8 @@ static l_mem singlestep (lua_State *L) {
       else {
         g->gcstate = GCSpause;  /* end collection */
         g->gcdept = 0;
+        g->gcstats.cycles++;
+        g->gcstats.lastfreed = g->gcfreed;
         return 0;
       }
     }
@@ -695,22 +984,39 @@ static l_mem singlestep (lua_State *L) {
 }
 
 
+/* 'singlestep' charging the time of a finished phase to its statistics */
+static l_mem timedstep (lua_State *L) {
+  global_State *g = G(L);
+  int phase = g->gcstate;
+  l_mem work = singlestep(L);
+  if (g->gcstate != phase)
+    chargephase(g, gcphase(phase));
+  return work;
+}
+
+
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   // 大致估算本次回收要回收多少数据
   // 其中，gcstepmul用于控制这次回收是GCSTEPSIZE的多少百分比
   // 显然这个数据越大，在后面的singlestep函数中调用的时间就越长
   l_mem lim = (GCSTEPSIZE/100) * g->gcstepmul;
+  double start;
   // 为0的情况说明是无限制，所以还是需要设置一个具体的数据
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
+  luai_gcclock(start);
+  g->gcclock = start;
   // 首先累加本次totalbytes和GCthreshold的差值，知道要到自动GC完毕要回收多少数据
   g->gcdept += g->totalbytes - g->GCthreshold;
+  luaS_migrate(L, GCMIGRATEMAX);  /* the string table may be resizing */
   do {
-    lim -= singlestep(L);
+    lim -= timedstep(L);
     if (g->gcstate == GCSpause)
       break;
   } while (lim > 0);
+  chargephase(g, gcphase(g->gcstate));
+  countstep(g, start);
   if (g->gcstate != GCSpause) {
 	 // 走到这里，说明lim不大于0，也就是本次自动GC将预估的数据大小全部回收了
     if (g->gcdept < GCSTEPSIZE)
@@ -736,6 +1042,7 @@ void luaC_step (lua_State *L) {
 // 完整的一次GC过程
 void luaC_fullgc (lua_State *L) {
   global_State *g = G(L);
+  luai_gcclock(g->gcclock);
   // 重新把所有对象都mark成白色
   if (g->gcstate <= GCSpropagate) {
     /* reset sweep marks to sweep all elements (returning them to white) */
@@ -747,6 +1054,9 @@ void luaC_fullgc (lua_State *L) {
     g->gray = NULL;
     g->grayagain = NULL;
     g->weak = NULL;
+    g->ephemeron = NULL;
+    g->allweak = NULL;
+    resetcensus(g);
     g->gcstate = GCSsweepstring;
   }
   lua_assert(g->gcstate != GCSpause && g->gcstate != GCSpropagate);
@@ -755,16 +1065,31 @@ void luaC_fullgc (lua_State *L) {
   // 所以这里只是将所有对象重新mark成白色
   while (g->gcstate != GCSfinalize) {
     lua_assert(g->gcstate == GCSsweepstring || g->gcstate == GCSsweep);
-    singlestep(L);
+    timedstep(L);
   }
   // 重新开始一次完整GC
   markroot(L);
   while (g->gcstate != GCSpause) {
-    singlestep(L);
+    timedstep(L);
   }
   setthreshold(g);
 }
 
+
+/*
+** Full collection from inside an allocation that would go over the memory
+** limit. It must not move or shrink anything the allocating code may be
+** using (stacks, the string table, the concatenation buffer) nor run
+** finalizers; those left in `tmudata' are called by a later cycle.
+*/
+void luaC_emergencygc (lua_State *L) {
+  global_State *g = G(L);
+  lua_assert(!g->gcemergency);
+  g->gcemergency = 1;
+  luaC_fullgc(L);
+  g->gcemergency = 0;
+}
+
 // GC向前走一步
 void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
@@ -793,6 +1118,8 @@ void luaC_barrierback (lua_State *L, Table *t) {
   lua_assert(isblack(o) && !isdead(g, o));
   lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);
   black2gray(o);  /* make table gray (again) */
+  if (testbits(t->marked, KEYWEAK | VALUEWEAK))
+    return;  /* weak tables are already in a weak list */
   // 把这个table加入grayagain链表,意思是原子扫描
   t->gclist = g->grayagain;
   g->grayagain = o;
@@ -805,6 +1132,7 @@ void luaC_link (lua_State *L, GCObject *o, unsigned char tt) {
   g->rootgc = o;
   o->gch.marked = luaC_white(g);
   o->gch.tt = tt;
+  luaC_recent(g, o);
 }
 
 /*
@@ -836,3 +1164,359 @@ void luaC_linkupval (lua_State *L, UpVal *uv) {
   }
 }
 
+
+
+
+/*
+** {======================================================
+** Heap snapshot
+** =======================================================
+*/
+
+/*
+** A snapshot is a binary stream, in native byte order, of every live
+** object and of the references the collector would follow from it:
+**   header:  "\033LuaHeap", version, sizeof(size_t), 1 if little endian
+**   roots:   n, id[n]
+**   objects: type (0 ends the stream), id, size, n, id[n], namelen, name
+**   or else: SNAPEPHEMERON, key id, value id
+** Ids (object addresses), sizes and counts are size_t; type and namelen
+** are bytes. References through weak keys or values are left out; a
+** value of an ephemeron table whose key can be collected is referenced
+** from that key (in a record of its own, after the table).
+** See etc/heapsnap.lua for a reader that computes retained sizes.
+*/
+
+#define SNAPVERSION	2
+#define SNAPEPHEMERON	255
+#define SNAPBUFFSIZE	8192
+#define SNAPSTRNAME	40	/* how much of a string goes in its name */
+
+
+typedef struct SnapState {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;
+  size_t n;  /* bytes used in 'buff' */
+  GCObject **edges;  /* references of the current object */
+  int nedges;
+  int sizeedges;
+  char buff[SNAPBUFFSIZE];
+} SnapState;
+
+
+static void snapflush (SnapState *S) {
+  if (S->status == 0 && S->n > 0) {
+    lua_unlock(S->L);
+    S->status = (*S->writer)(S->L, S->buff, S->n, S->data);
+    lua_lock(S->L);
+  }
+  S->n = 0;
+}
+
+
+static void snapblock (SnapState *S, const void *b, size_t size) {
+  if (S->n + size > SNAPBUFFSIZE) {
+    snapflush(S);
+    if (size > SNAPBUFFSIZE) {  /* too big for the buffer? */
+      if (S->status == 0) {
+        lua_unlock(S->L);
+        S->status = (*S->writer)(S->L, b, size, S->data);
+        lua_lock(S->L);
+      }
+      return;
+    }
+  }
+  memcpy(S->buff + S->n, b, size);
+  S->n += size;
+}
+
+
+static void snapbyte (SnapState *S, int b) {
+  char c = cast(char, b);
+  snapblock(S, &c, 1);
+}
+
+
+static void snapsize (SnapState *S, size_t x) {
+  snapblock(S, &x, sizeof(x));
+}
+
+
+static void snapid (SnapState *S, const GCObject *o) {
+  snapsize(S, cast(size_t, o));
+}
+
+
+static void addedge (SnapState *S, GCObject *o) {
+  if (o == NULL) return;
+  luaM_growvector(S->L, S->edges, S->nedges, S->sizeedges, GCObject *,
+                  MAX_INT, "snapshot references");
+  S->edges[S->nedges++] = o;
+}
+
+
+static void addvalue (SnapState *S, const TValue *o) {
+  if (iscollectable(o))
+    addedge(S, gcvalue(o));
+}
+
+
+/* keys of weak-key tables that keep their values (as in `iscleared') */
+#define ephemeronkey(k)	(iscollectable(k) && !ttisstring(k))
+
+
+static void weakmode (global_State *g, Table *h, int *weakkey,
+                      int *weakvalue) {
+  const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+  *weakkey = *weakvalue = 0;
+  if (mode && ttisstring(mode)) {
+    *weakkey = (memchr(svalue(mode), 'k', tsvalue(mode)->len) != NULL);
+    *weakvalue = (memchr(svalue(mode), 'v', tsvalue(mode)->len) != NULL);
+  }
+}
+
+
+static void tableedges (SnapState *S, Table *h) {
+  int weakkey, weakvalue;
+  int i;
+  addedge(S, obj2gco(h->metatable));
+  weakmode(G(S->L), h, &weakkey, &weakvalue);
+  if (!weakvalue) {
+    for (i = 0; i < h->sizearray; i++)
+      addvalue(S, &h->array[i]);
+  }
+  for (i = 0; i < h->shape->nslots; i++) {
+    if (ttisnil(&h->slots[i])) continue;
+    addedge(S, obj2gco(h->shape->keys[i]));
+    if (!weakvalue) addvalue(S, &h->slots[i]);
+  }
+  for (i = 0; i < sizenode(h); i++) {
+    Node *n = gnode(h, i);
+    if (ttisnil(gval(n))) continue;
+    if (!weakkey) addvalue(S, key2tval(n));
+    if (!weakvalue && !(weakkey && ephemeronkey(key2tval(n))))
+      addvalue(S, gval(n));
+  }
+}
+
+
+/* values of an ephemeron table are referenced from their keys */
+static void snapephemerons (SnapState *S, Table *h) {
+  int weakkey, weakvalue;
+  int i;
+  weakmode(G(S->L), h, &weakkey, &weakvalue);
+  if (!weakkey || weakvalue) return;
+  for (i = 0; i < sizenode(h); i++) {
+    Node *n = gnode(h, i);
+    if (!ttisnil(gval(n)) && ephemeronkey(key2tval(n)) &&
+        iscollectable(gval(n))) {
+      snapbyte(S, SNAPEPHEMERON);
+      snapid(S, gcvalue(key2tval(n)));
+      snapid(S, gcvalue(gval(n)));
+    }
+  }
+}
+
+
+static void protoname (char *buff, Proto *p) {
+  if (p->source == NULL)
+    strcpy(buff, "?");
+  else
+    luaO_chunkid(buff, getstr(p->source), LUA_IDSIZE);
+  sprintf(buff + strlen(buff), ":%d", p->linedefined);
+}
+
+
+static void snapobject (SnapState *S, GCObject *o) {
+  char name[LUA_IDSIZE + 20];
+  size_t namelen;
+  size_t size;
+  int i;
+  name[0] = '\0';
+  S->nedges = 0;
+  switch (o->gch.tt) {
+    case LUA_TSTRING: {
+      TString *ts = rawgco2ts(o);
+      size = luaS_bytes(ts);
+      namelen = (ts->tsv.len < SNAPSTRNAME) ? ts->tsv.len : SNAPSTRNAME;
+      memcpy(name, getstr(ts), namelen);
+      name[namelen] = '\0';
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = rawgco2u(o);
+      size = sizeudata(&u->uv);
+      addedge(S, obj2gco(u->uv.metatable));
+      addedge(S, obj2gco(u->uv.env));
+      break;
+    }
+    case LUA_TTABLE: {
+      Table *h = gco2h(o);
+      size = luaH_bytes(h);
+      tableedges(S, h);
+      break;
+    }
+    case LUA_TFUNCTION: {
+      Closure *cl = gco2cl(o);
+      addedge(S, obj2gco(cl->c.env));
+      if (cl->c.isC) {
+        size = sizeCclosure(cl->c.nupvalues);
+        for (i = 0; i < cl->c.nupvalues; i++)
+          addvalue(S, &cl->c.upvalue[i]);
+        strcpy(name, "=[C]");
+      }
+      else {
+        size = sizeLclosure(cl->l.nupvalues);
+        addedge(S, obj2gco(cl->l.p));
+        for (i = 0; i < cl->l.nupvalues; i++)
+          addedge(S, obj2gco(cl->l.upvals[i]));
+        protoname(name, cl->l.p);
+      }
+      break;
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      StkId p;
+      size = sizeof(lua_State) + sizeof(TValue) * th->stacksize +
+                                 sizeof(CallInfo) * th->size_ci;
+      addvalue(S, gt(th));
+      for (p = th->stack; p < th->top; p++)
+        addvalue(S, p);
+      break;
+    }
+    case LUA_TPROTO: {
+      Proto *f = gco2p(o);
+      size = sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                             sizeof(Proto *) * f->sizep +
+                             sizeof(TValue) * f->sizek +
+                             sizeof(int) * f->sizelineinfo +
+                             sizeof(LocVar) * f->sizelocvars +
+                             sizeof(TString *) * f->sizeupvalues;
+      addedge(S, obj2gco(f->source));
+      for (i = 0; i < f->sizek; i++)
+        addvalue(S, &f->k[i]);
+      for (i = 0; i < f->sizep; i++)
+        addedge(S, obj2gco(f->p[i]));
+      for (i = 0; i < f->sizeupvalues; i++)
+        addedge(S, obj2gco(f->upvalues[i]));
+      for (i = 0; i < f->sizelocvars; i++)
+        addedge(S, obj2gco(f->locvars[i].varname));
+      protoname(name, f);
+      break;
+    }
+    case LUA_TUPVAL: {
+      size = sizeof(UpVal);
+      addvalue(S, gco2uv(o)->v);
+      break;
+    }
+    default: lua_assert(0); return;
+  }
+  snapbyte(S, o->gch.tt);
+  snapid(S, o);
+  snapsize(S, size);
+  snapsize(S, cast(size_t, S->nedges));
+  for (i = 0; i < S->nedges; i++)
+    snapid(S, S->edges[i]);
+  namelen = strlen(name);
+  snapbyte(S, cast_int(namelen));
+  snapblock(S, name, namelen);
+  if (o->gch.tt == LUA_TTABLE)
+    snapephemerons(S, gco2h(o));
+}
+
+
+static void snaplist (SnapState *S, GCObject *o) {
+  global_State *g = G(S->L);
+  for (; o != NULL; o = o->gch.next) {
+    if (isdead(g, o)) continue;  /* not yet swept */
+    snapobject(S, o);
+    if (o->gch.tt == LUA_TTHREAD)  /* open upvalues live in the thread */
+      snaplist(S, gco2th(o)->openupval);
+  }
+}
+
+
+static void snaproots (SnapState *S) {
+  global_State *g = G(S->L);
+  GCObject *roots[NUM_TAGS + 4];
+  int n = 0;
+  int i;
+  roots[n++] = obj2gco(g->mainthread);
+  if (S->L != g->mainthread)
+    roots[n++] = obj2gco(S->L);
+  if (iscollectable(registry(S->L)))
+    roots[n++] = gcvalue(registry(S->L));
+  for (i = 0; i < NUM_TAGS; i++)
+    if (g->mt[i]) roots[n++] = obj2gco(g->mt[i]);
+  if (g->tmudata) {  /* userdata waiting for finalization */
+    GCObject *u = g->tmudata;
+    int nu = 1;
+    while ((u = u->gch.next) != g->tmudata) nu++;
+    snapsize(S, cast(size_t, n + nu));
+    do {
+      u = u->gch.next;
+      snapid(S, u);
+    } while (u != g->tmudata);
+  }
+  else
+    snapsize(S, cast(size_t, n));
+  for (i = 0; i < n; i++)
+    snapid(S, roots[i]);
+}
+
+
+static void f_snapshot (lua_State *L, void *ud) {
+  SnapState *S = cast(SnapState *, ud);
+  global_State *g = G(L);
+  int endian = 1;
+  int i;
+  snapblock(S, "\033LuaHeap", 8);
+  snapbyte(S, SNAPVERSION);
+  snapbyte(S, sizeof(size_t));
+  snapbyte(S, *cast(char *, &endian));
+  snaproots(S);
+  snaplist(S, g->rootgc);
+  for (i = 0; i < luaS_nbuckets(&g->strt); i++)
+    snaplist(S, *luaS_bucket(&g->strt, i));
+  if (g->tmudata) {
+    GCObject *u = g->tmudata;
+    do {
+      u = u->gch.next;
+      snapobject(S, u);
+    } while (u != g->tmudata);
+  }
+  snapbyte(S, 0);  /* end of stream */
+  snapflush(S);
+}
+
+
+/*
+** Write a snapshot of the whole heap. 'w' must not use the Lua state:
+** the walk does not allocate objects and must see the lists unchanged.
+** The walk runs protected, so that an error (e.g. a memory error while
+** growing the edge buffer) cannot leave the collector disabled.
+*/
+int luaC_snapshot (lua_State *L, lua_Writer w, void *data) {
+  global_State *g = G(L);
+  unsigned char oldemergency = g->gcemergency;
+  SnapState S;
+  int status;
+  S.L = L;
+  S.writer = w;
+  S.data = data;
+  S.status = 0;
+  S.n = 0;
+  S.edges = NULL;
+  S.nedges = S.sizeedges = 0;
+  g->gcemergency = 1;  /* must not collect while walking the lists */
+  status = luaD_rawrunprotected(L, f_snapshot, &S);
+  g->gcemergency = oldemergency;
+  luaM_freearray(L, S.edges, S.sizeedges, GCObject *);
+  if (status != 0)
+    luaD_throw(L, status);  /* propagate the error */
+  return S.status;
+}
+
+/* }====================================================== */
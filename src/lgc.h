@@ -120,6 +120,10 @@
 	luaC_step(L); }
 
 
+/* remember an object just created or found, for emergency collections */
+#define luaC_recent(g,o)	((g)->gcrecent[(g)->gcnrecent++ % GCRECENT] = (o))
+
+
 #define luaC_barrier(L,p,v) { if (valiswhite(v) && isblack(obj2gco(p)))  \
 	luaC_barrierf(L,obj2gco(p),gcvalue(v)); }
 
@@ -136,13 +140,16 @@
 
 LUAI_FUNC size_t luaC_separateudata (lua_State *L, int all);
 LUAI_FUNC void luaC_callGCTM (lua_State *L);
+LUAI_FUNC int luaC_runfinalizers (lua_State *L, int max);
 LUAI_FUNC void luaC_freeall (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_fullgc (lua_State *L);
+LUAI_FUNC void luaC_emergencygc (lua_State *L);
 LUAI_FUNC void luaC_link (lua_State *L, GCObject *o, unsigned char tt);
 LUAI_FUNC void luaC_linkupval (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback (lua_State *L, Table *t);
+LUAI_FUNC int luaC_snapshot (lua_State *L, lua_Writer w, void *data);
 
 
 #endif
@@ -24,6 +24,8 @@ static const luaL_Reg lualibs[] = {
   {LUA_STRLIBNAME, luaopen_string},
   {LUA_MATHLIBNAME, luaopen_math},
   {LUA_DBLIBNAME, luaopen_debug},
+  {LUA_ARRAYLIBNAME, luaopen_array},
+  {LUA_STRBUFLIBNAME, luaopen_strbuf},
   {NULL, NULL}
 };
 
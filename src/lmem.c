@@ -15,6 +15,7 @@
 
 #include "ldebug.h"
 #include "ldo.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -65,6 +66,7 @@ void *luaM_growaux_ (lua_State *L, void *block, int *size, size_t size_elems,
 
 
 void *luaM_toobig (lua_State *L) {
+  G(L)->alloctt = 0;  /* the object will not be allocated */
   luaG_runerror(L, "memory allocation error: block too big");
   return NULL;  /* to avoid warnings */
 }
@@ -76,7 +78,22 @@ void *luaM_toobig (lua_State *L) {
 */
 void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   global_State *g = G(L);
+  int tt = g->alloctt;  /* type of the object being created (if known) */
+  g->alloctt = 0;
   lua_assert((osize == 0) == (block == NULL));
+  if (nsize > osize && g->memlimit != 0 &&
+      g->totalbytes - osize + nsize > g->memlimit) {  /* over the limit? */
+    if (!g->gcemergency)
+      luaC_emergencygc(L);  /* try to free some memory first */
+    if (g->totalbytes - osize + nsize > g->memlimit)
+      luaD_throw(L, LUA_ERRMEM);
+  }
+  if (nsize > osize && g->allocrate > 0) {  /* profiling allocations? */
+    /* sample before reallocating, while the stack is still consistent */
+    g->allocnext -= cast(l_mem, nsize - osize);
+    if (g->allocnext <= 0)
+      luaG_allocsample(L, tt);
+  }
   block = (*g->frealloc)(g->ud, block, osize, nsize);
   if (block == NULL && nsize > 0)
     luaD_throw(L, LUA_ERRMEM);
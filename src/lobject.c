@@ -81,6 +81,8 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
       return bvalue(t1) == bvalue(t2);  /* boolean true must be 1 !! */
     case LUA_TLIGHTUSERDATA:
       return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING:
+      return luaS_eqstr(rawtsvalue(t1), rawtsvalue(t2));
     default:
       lua_assert(iscollectable(t1));
       return gcvalue(t1) == gcvalue(t2);
@@ -88,8 +90,93 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
 }
 
 
+#if defined(LUAI_FASTSTR2NUM) || defined(LUAI_FASTNUM2STR)
+
+/* powers of 10 that are exact doubles */
+static const double powers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAXPOWER	22
+
+#endif
+
+
+#if defined(LUAI_FASTSTR2NUM)
+
+#define MAXSIGDIGITS	15	/* any integer with 15 digits is exact */
+
+#define TWOTO53		9007199254740992.0
+
+
+/*
+** Reads a plain decimal numeral (spaces, sign, digits, point, exponent,
+** spaces) whose significant digits fit in an exact integer `m' and
+** whose value is `m' times or over an exact power of 10: one IEEE
+** operation then gives the correctly rounded result, as `strtod' would.
+** Returns 0 for anything else (hexadecimals, too many digits, `inf'...),
+** which goes to `lua_str2number'.
+*/
+static int readdecimal (const char *s, lua_Number *result) {
+  double m = 0;
+  int nd = 0;  /* significant digits in `m' */
+  int e = 0;  /* decimal exponent of `m' */
+  int neg = 0, any = 0;
+  while (isspace(cast(unsigned char, *s))) s++;
+  if (*s == '-') { s++; neg = 1; }
+  else if (*s == '+') s++;
+  for (; isdigit(cast(unsigned char, *s)); s++, any = 1) {
+    if (nd < MAXSIGDIGITS) {
+      m = m * 10 + (*s - '0');
+      if (m > 0) nd++;
+    }
+    else if (*s != '0') return 0;  /* too many digits */
+    else e++;
+  }
+  if (*s == '.') {
+    for (s++; isdigit(cast(unsigned char, *s)); s++, any = 1) {
+      if (nd < MAXSIGDIGITS) {
+        m = m * 10 + (*s - '0');
+        e--;
+        if (m > 0) nd++;
+      }
+      else if (*s != '0') return 0;  /* too many digits */
+    }
+  }
+  if (!any) return 0;
+  if (*s == 'e' || *s == 'E') {
+    int x = 0, eneg = 0;
+    s++;
+    if (*s == '-') { s++; eneg = 1; }
+    else if (*s == '+') s++;
+    if (!isdigit(cast(unsigned char, *s))) return 0;
+    for (; isdigit(cast(unsigned char, *s)); s++)
+      if (x < 10000) x = x * 10 + (*s - '0');
+    e += eneg ? -x : x;
+  }
+  while (isspace(cast(unsigned char, *s))) s++;
+  if (*s != '\0') return 0;
+  if (m == 0) e = 0;  /* (zero with any exponent) */
+  else if (e > MAXPOWER && e <= MAXPOWER + MAXSIGDIGITS &&
+           m * powers[e - MAXPOWER] < TWOTO53) {  /* still exact? */
+    m *= powers[e - MAXPOWER];
+    e = MAXPOWER;
+  }
+  if (e > MAXPOWER || e < -MAXPOWER) return 0;
+  m = (e >= 0) ? m * powers[e] : m / powers[-e];
+  *result = neg ? -m : m;
+  return 1;
+}
+
+#endif
+
+
 int luaO_str2d (const char *s, lua_Number *result) {
   char *endptr;
+#if defined(LUAI_FASTSTR2NUM)
+  if (readdecimal(s, result)) return 1;  /* most common case */
+#endif
   *result = lua_str2number(s, &endptr);
   if (endptr == s) return 0;  /* conversion failed */
   if (*endptr == 'x' || *endptr == 'X')  /* maybe an hexadecimal constant? */
@@ -101,6 +188,129 @@ int luaO_str2d (const char *s, lua_Number *result) {
 }
 
 
+#if defined(LUAI_FASTNUM2STR)
+
+#define NDIGITS		14	/* significant digits of "%.14g" */
+
+
+/* writes the `n' decimal digits of integer `d' (< 10^n) in `s' */
+static void writedigits (char *s, double d, int n) {
+  while (n > 0) {  /* 7 digits at a time, in exact integer pieces */
+    int k = (n < 7) ? n : 7;
+    double hi = floor(d / powers[k]);
+    unsigned long lo = cast(unsigned long, d - hi * powers[k]);
+    n -= k;
+    while (k-- > 0) {
+      s[n + k] = cast(char, '0' + lo % 10);
+      lo /= 10;
+    }
+    d = hi;
+  }
+}
+
+
+/*
+** Writes the 14 significant digits of `x' (> 0) rounded to nearest in
+** `d' and returns its decimal exponent, or returns INT_MAX when that
+** cannot be done exactly here. `x' is scaled by an exact power of 10,
+** so the scaled value has one rounding error, below 1/64; the rounding
+** to an integer is exact unless that value is too close to a half.
+*/
+static int scaledigits (char *d, double x) {
+  int e = cast_int(floor(log10(x)));  /* may be off by one */
+  int i;
+  for (i = 0; i < 2; i++) {
+    int k = NDIGITS - 1 - e;
+    double v, f;
+    if (k > MAXPOWER || k < -MAXPOWER) break;
+    v = (k >= 0) ? x * powers[k] : x / powers[-k];
+    if (v < powers[NDIGITS - 1]) e--;
+    else if (v >= powers[NDIGITS]) e++;
+    else {
+      f = v - floor(v);
+      if (f > 0.49 && f < 0.51) break;  /* maybe a tie: not sure */
+      v = floor(v) + (f > 0.5);
+      if (v == powers[NDIGITS]) {  /* rounded up to the next power? */
+        v = powers[NDIGITS - 1];
+        e++;
+      }
+      writedigits(d, v, NDIGITS);
+      return e;
+    }
+  }
+  return INT_MAX;
+}
+
+
+/*
+** Converts a number to the text "%.14g" would give. Integral values
+** below 10^14 are written directly; other finite values go through
+** `scaledigits'; what it cannot handle (or infinities and NaN) goes to
+** `lua_number2str'. Returns the length of the text.
+*/
+int luaO_num2str (char *s, lua_Number n) {
+  char d[NDIGITS];
+  char *p = s;
+  int e, nd;
+  double x = (n < 0) ? -n : n;
+  if (x < powers[NDIGITS] && x == floor(x)) {  /* integer? */
+    if (n < 0 || (n == 0 && 1/n < 0)) *p++ = '-';  /* (also -0) */
+    for (nd = 1; nd < NDIGITS && x >= powers[nd]; nd++) ;
+    writedigits(p, x, nd);
+    p[nd] = '\0';
+    return cast_int(p - s) + nd;
+  }
+  if (luai_numisnan(n) || x - x != 0 ||  /* not finite? */
+      (e = scaledigits(d, x)) == INT_MAX) {
+    lua_number2str(s, n);
+    return cast_int(strlen(s));
+  }
+  if (n < 0) *p++ = '-';
+  for (nd = NDIGITS; nd > 1 && d[nd - 1] == '0'; nd--) ;  /* no trailing 0s */
+  if (e < -4 || e >= NDIGITS) {  /* exponent form */
+    *p++ = d[0];
+    if (nd > 1) {
+      *p++ = '.';
+      memcpy(p, d + 1, nd - 1);
+      p += nd - 1;
+    }
+    *p++ = 'e';
+    *p++ = (e < 0) ? '-' : '+';
+    if (e < 0) e = -e;
+    if (e >= 100) *p++ = cast(char, '0' + e / 100);
+    *p++ = cast(char, '0' + e / 10 % 10);
+    *p++ = cast(char, '0' + e % 10);
+  }
+  else if (e >= 0) {  /* `e + 1' digits before the point */
+    int i;
+    for (i = 0; i <= e; i++)
+      *p++ = (i < nd) ? d[i] : '0';
+    if (nd > e + 1) {  /* (rounding may leave no fraction) */
+      *p++ = '.';
+      memcpy(p, d + e + 1, nd - e - 1);
+      p += nd - e - 1;
+    }
+  }
+  else {  /* 0.000ddd */
+    *p++ = '0';
+    *p++ = '.';
+    while (++e < 0) *p++ = '0';
+    memcpy(p, d, nd);
+    p += nd;
+  }
+  *p = '\0';
+  return cast_int(p - s);
+}
+
+#else
+
+int luaO_num2str (char *s, lua_Number n) {
+  lua_number2str(s, n);
+  return cast_int(strlen(s));
+}
+
+#endif
+
 
 static void pushstr (lua_State *L, const char *str) {
   setsvalue2s(L, L->top, luaS_new(L, str));
@@ -166,7 +376,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
   pushstr(L, fmt);
   luaV_concat(L, n+1, cast_int(L->top - L->base) - 1);
   L->top -= n;
-  return svalue(L->top - 1);
+  return luaS_cstr(L, rawtsvalue(L->top - 1));
 }
 
 
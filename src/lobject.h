@@ -225,13 +225,38 @@ typedef union TString {
     CommonHeader;
     /* 标识这个字符串是否是Lua虚拟机中的保留字符串。如果这个值为1，那么将不会再GC阶段被回收，而是一直保留在系统中。 */
     unsigned char reserved; 
+    unsigned char extra;  /* long strings: STRHASHED, STRROPE */
     unsigned int hash; /* 字符串的散列值 */
     size_t len; /* 字符串长度 */
   } tsv;
 } TString;
 
 
-#define getstr(ts)	cast(const char *, (ts) + 1)
+/* bits in `extra' */
+#define STRHASHED	1  /* `hash' is computed */
+#define STRROPE		2  /* contents are in a `Rope' */
+
+
+/*
+** Buffer shared by rope strings. A concatenation whose first operand is
+** the longest string using a buffer writes the other operands after it,
+** so a string built piece by piece is not copied at each step. Strings
+** sharing a buffer are prefixes of each other; only the longest one is
+** followed by a '\0'
+*/
+typedef struct Rope {
+  char *data;
+  size_t used;  /* length of the longest string using it */
+  size_t size;  /* size of `data' */
+  int nstrings;  /* number of strings using it */
+  unsigned char fixed;  /* C code may hold `data': do not append or move it
+                          (ROPEEXTERNAL: the bytes belong to the host) */
+} Rope;
+
+#define ropeof(ts)	(*cast(Rope **, (ts) + 1))
+
+#define getstr(ts)	(((ts)->tsv.extra & STRROPE) ? \
+	cast(const char *, ropeof(ts)->data) : cast(const char *, (ts) + 1))
 #define svalue(o)       getstr(rawtsvalue(o))
 
 
@@ -347,7 +372,6 @@ typedef union TKey {
   struct {
     Value value; 
     int tt;
-    struct Node *next;  /* for chaining */
   } nk;
   TValue tvk;
 } TKey;
@@ -359,6 +383,33 @@ typedef struct Node {
 } Node;
 
 
+/*
+** Shapes: tables that receive the same string keys in the same order
+** share a shape, which maps each of these keys to a slot of the table's
+** `slots' array. Shapes form a tree of transitions from the empty shape;
+** the collector frees those that no table uses (see `luaH_sweepshapes').
+*/
+typedef struct Shape {
+  struct Shape *next;  /* list of all shapes (children before parents) */
+  struct Shape *parent;  /* shape this one was derived from */
+  struct Shape *child;  /* first shape derived from this one */
+  struct Shape *sibling;  /* next shape derived from the same parent */
+  int nslots;  /* number of keys */
+  int marked;  /* used by some table since the last sweep? */
+  unsigned int keybits;  /* bit `hash % 32' of each key (a quick filter) */
+  TString *keys[1];  /* keys in slot order */
+} Shape;
+
+
+/*
+** per-instruction cache of the slot of a field (see `luaH_getfield')
+*/
+typedef struct FieldCache {
+  Shape *shape;
+  int slot;
+} FieldCache;
+
+
 typedef struct Table {
   CommonHeader;
   /*
@@ -373,14 +424,17 @@ typedef struct Table {
     即如果散列桶数组要扩展的话，也是以每次在原大小基础上乘以2的形式扩展。
   */
   unsigned char lsizenode;  /* log2 of size of `node' array */
+  unsigned char sizeslots;  /* size of `slots' array */
   struct Table *metatable; /* 存放该表的元表 */
   TValue *array;  /* 指向数组部分的指针 */
   Node *node; /* 指向该表的散列桶数组起始位置的指针 */
-  /* 指向该表散列桶数组的最后位置的指针 */
-  Node *lastfree;  /* any free position is before this position */
+  int hfree;  /* number of nodes that can still be used before a rehash */
+  Shape *shape;  /* string keys kept in `slots' */
+  TValue *slots;  /* values of the keys in `shape' */
   GCObject *gclist; /* GC相关的链表 */
   /* 数组部分的大小 */
   int sizearray;  /* size of `array' array */
+  int border;  /* last result of `luaH_getn' (a hint) */
 } Table;
 
 
@@ -410,6 +464,7 @@ LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
+LUAI_FUNC int luaO_num2str (char *s, lua_Number n);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
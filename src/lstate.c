@@ -7,6 +7,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #define lstate_c
 #define LUA_CORE
@@ -121,15 +122,19 @@ static void close_state (lua_State *L) {
   lua_assert(g->rootgc == obj2gco(L));
   lua_assert(g->strt.nuse == 0);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
+  luaM_freearray(L, G(L)->strt.oldhash, G(L)->strt.oldsize, TString *);
   luaZ_freebuffer(L, &g->buff);
   freestack(L, L);
+  luaG_freeallocprofile(L);
+  luaH_freeshapes(L);
   lua_assert(g->totalbytes == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), state_size(LG), 0);
 }
 
 
 lua_State *luaE_newthread (lua_State *L) {
-  lua_State *L1 = tostate(luaM_malloc(L, state_size(lua_State)));
+  lua_State *L1 = tostate(luaM_newobject(L, LUA_TTHREAD,
+                                         state_size(lua_State)));
   luaC_link(L, obj2gco(L1), LUA_TTHREAD);
   preinit_state(L1, G(L));
   stack_init(L1, L);  /* init stack */
@@ -151,12 +156,45 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
   luaM_freemem(L, fromstate(L1), state_size(lua_State));
 }
 
+/*
+** a seed for string hashes that changes from run to run (and from state
+** to state): the current time mixed with some addresses, which vary
+** with address-space randomization
+*/
+#if !defined(luai_makeseed)
+#include <time.h>
+#define luai_makeseed()		cast(unsigned int, time(NULL))
+#endif
+
+#define addbuff(b,p,e) \
+  { size_t t = cast(size_t, e); \
+    memcpy(buff + p, &t, sizeof(t)); p += sizeof(t); }
+
+static unsigned int makeseed (void) {
+  char buff[3 * sizeof(size_t)];
+  unsigned int h = luai_makeseed();
+  int p = 0;
+  addbuff(buff, p, &h);  /* local variable */
+  addbuff(buff, p, luaO_nilobject);  /* global variable */
+  addbuff(buff, p, &lua_newstate);  /* public function */
+  lua_assert(p == sizeof(buff));
+  return luaS_hashbytes(buff, p, h);
+}
+
+
+LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
+  return lua_newstateseed(f, ud, makeseed());
+}
+
+
 /**
  * 创建一个运行在新的独立的状态机中的线程。如果无法创建线程或状态机（内存有限）则返回NULL。
  * f：分配器函数；Lua将通过这个函数作状态机内所有的内存分配操作。
  * ud：这个指针在每次调用分配器时被转入
+ * seed：字符串散列的种子（lua_newstate 使用随机的种子）
 */
-LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
+LUA_API lua_State *lua_newstateseed (lua_Alloc f, void *ud,
+                                     unsigned int seed) {
   int i;
   lua_State *L;
   global_State *g;
@@ -172,6 +210,9 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   preinit_state(L, g);
   g->frealloc = f;
   g->ud = ud;
+  g->freeall = NULL;
+  g->nexternal = 0;
+  for (i=0; i<LUAI_NUMCACHE; i++) g->numcache[i].s = NULL;
   g->mainthread = L;
   g->uvhead.u.l.prev = &g->uvhead;
   g->uvhead.u.l.next = &g->uvhead;
@@ -179,10 +220,24 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->strt.size = 0;
   g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.oldhash = NULL;
+  g->strt.oldsize = 0;
+  g->strt.nmoved = 0;
+  g->seed = seed;
   setnilvalue(registry(L));
   luaZ_initbuffer(L, &g->buff);
   g->panic = NULL;
   g->gcstate = GCSpause;
+  g->gcdeferfin = 0;
+  g->gcemergency = 0;
+  g->memlimit = 0;
+  for (i=0; i<GCRECENT; i++) g->gcrecent[i] = NULL;
+  g->gcnrecent = 0;
+  g->alloctt = 0;
+  g->allocrate = 0;
+  g->allocnext = 0;
+  g->allocprof = NULL;
+  luaH_initshapes(L);
   /* 初始化为主线程 */
   g->rootgc = obj2gco(L);
   g->sweepstrgc = 0;
@@ -190,11 +245,17 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gray = NULL;
   g->grayagain = NULL;
   g->weak = NULL;
+  g->ephemeron = NULL;
+  g->allweak = NULL;
   g->tmudata = NULL;
   g->totalbytes = sizeof(LG);
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
   g->gcdept = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  memset(g->gccensus, 0, sizeof(g->gccensus));
+  g->gcclock = 0;
+  g->gcfreed = 0;
   for (i=0; i<NUM_TAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != 0) {
     /* memory allocation error: free partial state */
@@ -228,6 +289,13 @@ LUA_API void lua_close (lua_State *L) {
   } while (luaD_rawrunprotected(L, callallgcTM, NULL) != 0);
   lua_assert(G(L)->tmudata == NULL);
   luai_userstateclose(L);
-  close_state(L);
+  if (G(L)->freeall) {  /* can drop the heap as a whole? */
+    lua_FreeAll f = G(L)->freeall;
+    if (G(L)->nexternal > 0)  /* host memory is not part of the heap */
+      luaS_freeexternal(L);
+    (*f)(G(L)->ud);
+  }
+  else
+    close_state(L);
 }
 
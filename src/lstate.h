@@ -33,6 +33,21 @@ struct lua_longjmp;  /* defined in ldo.c */
 
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
+/* number of recently created objects kept by an emergency collection */
+#define GCRECENT	8
+
+/* number of entries of the field cache of `luaV_execute' (power of 2) */
+#define FIELDCACHE	256
+
+
+/*
+** entry of the cache of strings of integers (see `luaV_tostring')
+*/
+typedef struct NumCache {
+  int n;
+  TString *s;  /* string of `n' (or NULL) */
+} NumCache;
+
 
 /*
   专门用于存放字符串的散列数组
@@ -41,6 +56,9 @@ typedef struct stringtable {
   GCObject **hash;
   lu_int32 nuse;  /* number of elements */
   int size;       // hash桶数组大小
+  GCObject **oldhash;  /* array being moved to `hash' (or NULL) */
+  int oldsize;
+  int nmoved;  /* buckets of `oldhash' already moved */
 } stringtable;
 
 
@@ -74,17 +92,24 @@ typedef struct global_State {
    类型的单向链表意义不同。它被挂接在stringtable这个hash表中。
    */
   stringtable strt;  /* hash table for strings，存放所有的字符串 */
+  unsigned int seed;  /* randomized seed for string hashes */
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to `frealloc' */
+  lua_FreeAll freeall;  /* to free the whole heap on close (or NULL) */
+  lu_mem nexternal;  /* number of strings using host memory */
   unsigned char currentwhite;
   unsigned char gcstate;  /* state of garbage collector */
+  unsigned char gcdeferfin;  /* leave `tmudata' to LUA_GCRUNFINALIZERS? */
+  unsigned char gcemergency;  /* in an emergency collection? */
   int sweepstrgc;  /* position of sweep in `strt' */
   /* 除string外的GCObject链表头在rootgc域中。初始化时，这个域被初始化为主线程。*/
   GCObject *rootgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* position of sweep in `rootgc' */
   GCObject *gray;  /* list of gray objects */
   GCObject *grayagain;  /* list of objects to be traversed atomically */
-  GCObject *weak;  /* list of weak tables (to be cleared) */
+  GCObject *weak;  /* list of tables with weak values (to be cleared) */
+  GCObject *ephemeron;  /* list of ephemeron tables (weak keys) */
+  GCObject *allweak;  /* list of all-weak tables (to be cleared) */
   // 所有有GC方法的udata都放在tmudata链表中
   GCObject *tmudata;  /* last element of list of userdata to be GC */
   Mbuffer buff;  /* temporary buffer for string concatentation */
@@ -92,6 +117,7 @@ typedef struct global_State {
   lu_mem GCthreshold;
   // 保存当前分配的总内存数量
   lu_mem totalbytes;  /* number of bytes currently allocated */
+  lu_mem memlimit;  /* hard limit for `totalbytes' (0 means no limit) */
   // 一个估算值，根据这个计算GCthreshold
   lu_mem estimate;  /* an estimate of number of bytes actually in use */
   // 当前待GC的数据大小，其实就是累加totalbytes和GCthreshold的差值
@@ -100,6 +126,20 @@ typedef struct global_State {
   int gcpause;  /* size of pause between successive GCs */
   // 每次进行GC操作回收的数据比例，见lgc.c/luaC_step函数
   int gcstepmul;  /* GC `granularity' */
+  lua_GCStats gcstats;  /* collector statistics (see lua_getgcstats) */
+  double gcclock;  /* start of the phase interval not yet accounted */
+  lu_mem gcfreed;  /* bytes freed by the current cycle */
+  unsigned long gccensus[LUA_GCNTYPES];  /* census of the current sweep */
+  GCObject *gcrecent[GCRECENT];  /* last objects created */
+  unsigned int gcnrecent;  /* number of objects created (modulo overflow) */
+  unsigned char alloctt;  /* type of the object being allocated (or 0) */
+  int allocrate;  /* bytes between allocation samples (0 means off) */
+  l_mem allocnext;  /* bytes left before the next allocation sample */
+  struct AllocProfile *allocprof;  /* sampled allocations by call stack */
+  Shape shaperoot;  /* shape of tables without string keys in slots */
+  int nshapes;  /* number of shapes (besides `shaperoot') */
+  FieldCache fieldcache[FIELDCACHE];  /* slots found by each instruction */
+  NumCache numcache[LUAI_NUMCACHE];  /* strings of converted integers */
   lua_CFunction panic;  /* to be called in unprotected errors */
   TValue l_registry;
   struct lua_State *mainthread;
@@ -0,0 +1,239 @@
+/*
+** $Id: lstrbuflib.c $
+** String buffers: mutable byte strings built by appending
+** See Copyright Notice in lua.h
+*/
+
+
+#include <stddef.h>
+#include <string.h>
+
+#define lstrbuflib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** A buffer is a full userdata holding this header; its bytes are in
+** another userdata, kept in the environment table of the buffer, so
+** they are allocated (and counted) by the collector like any object.
+** The bytes are replaced by a block twice as large when they do not
+** fit, so appending is amortized constant time.
+*/
+typedef struct StrBuf {
+  char *b;  /* contents */
+  size_t n;  /* number of bytes in use */
+  size_t size;  /* size of `b' */
+} StrBuf;
+
+
+#define MINBUFFER	32
+
+#define MAXBUFFER	(~(size_t)0 - 1)
+
+#define tostrbuf(L,i)	((StrBuf *)luaL_checkudata(L, i, LUA_STRBUFHANDLE))
+
+
+/*
+** makes room for `extra' more bytes in the buffer at index `i'
+*/
+static char *prepbuffer (lua_State *L, int i, size_t extra) {
+  StrBuf *sb = (StrBuf *)lua_touserdata(L, i);
+  if (sb->size - sb->n < extra) {  /* must grow? */
+    size_t newsize = (sb->size < MINBUFFER) ? MINBUFFER : sb->size;
+    char *nb;
+    if (extra > MAXBUFFER - sb->n)
+      luaL_error(L, "string buffer too large");
+    while (newsize - sb->n < extra)
+      newsize = (newsize <= MAXBUFFER / 2) ? 2 * newsize : MAXBUFFER;
+    lua_getfenv(L, i);
+    nb = (char *)lua_newuserdata(L, newsize);
+    if (sb->n > 0)  /* (no old bytes, maybe no old block) */
+      memcpy(nb, sb->b, sb->n);
+    lua_rawseti(L, -2, 1);  /* old bytes become garbage */
+    lua_pop(L, 1);
+    sb->b = nb;
+    sb->size = newsize;
+  }
+  return sb->b + sb->n;
+}
+
+
+static void putlstring (lua_State *L, int i, const char *s, size_t l) {
+  StrBuf *sb = (StrBuf *)lua_touserdata(L, i);
+  memcpy(prepbuffer(L, i, l), s, l);
+  sb->n += l;
+}
+
+
+/*
+** appends the value at index `arg' (a string, a number, another buffer
+** or a value with a `__tostring' metamethod) to the buffer at `i'
+*/
+static void putvalue (lua_State *L, int i, int arg) {
+  size_t l;
+  const char *s = strbuf_tolstring(L, arg, &l);
+  if (s == NULL) {
+    if (luaL_callmeta(L, arg, "__tostring")) {
+      if (!lua_isstring(L, -1))
+        luaL_error(L, "'__tostring' must return a string");
+      lua_replace(L, arg);
+    }
+    s = luaL_checklstring(L, arg, &l);
+  }
+  else if (lua_rawequal(L, i, arg)) {  /* appending a buffer to itself? */
+    prepbuffer(L, i, l);
+    s = strbuf_tolstring(L, arg, &l);  /* its bytes may have moved */
+  }
+  putlstring(L, i, s, l);
+}
+
+
+static int buf_new (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  StrBuf *sb;
+  luaL_argcheck(L, size >= 0, 1, "invalid size");
+  sb = (StrBuf *)lua_newuserdata(L, sizeof(StrBuf));
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_getmetatable(L, LUA_STRBUFHANDLE);
+  lua_setmetatable(L, -2);
+  lua_createtable(L, 1, 0);  /* will hold the bytes */
+  lua_setfenv(L, -2);
+  if (size > 0)
+    prepbuffer(L, lua_gettop(L), (size_t)size);
+  return 1;
+}
+
+
+static int buf_put (lua_State *L) {
+  int n = lua_gettop(L);
+  int arg;
+  tostrbuf(L, 1);
+  for (arg = 2; arg <= n; arg++)
+    putvalue(L, 1, arg);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** `string.format' (an upvalue) writes the formatted text, which is then
+** appended
+*/
+static int buf_putf (lua_State *L) {
+  size_t l;
+  const char *s;
+  tostrbuf(L, 1);
+  luaL_checkstring(L, 2);
+  if (!lua_isfunction(L, lua_upvalueindex(1)))
+    luaL_error(L, "'putf' needs the string library");
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 2);
+  lua_call(L, lua_gettop(L) - 2, 1);
+  s = lua_tolstring(L, -1, &l);
+  putlstring(L, 1, s, l);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_reserve (lua_State *L) {
+  lua_Integer n = luaL_checkinteger(L, 2);
+  tostrbuf(L, 1);
+  luaL_argcheck(L, n >= 0, 2, "invalid size");
+  prepbuffer(L, 1, (size_t)n);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_reset (lua_State *L) {
+  tostrbuf(L, 1)->n = 0;  /* keeps its space for reuse */
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_tostring (lua_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  lua_pushlstring(L, sb->b, sb->n);
+  return 1;
+}
+
+
+static int buf_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)tostrbuf(L, 1)->n);
+  return 1;
+}
+
+
+/*
+** contents of the string buffer at index `idx', or NULL when it is not
+** a string buffer; they stay valid until the buffer is changed
+*/
+LUALIB_API const char *strbuf_tolstring (lua_State *L, int idx, size_t *len) {
+  StrBuf *sb = (StrBuf *)lua_touserdata(L, idx);
+  if (sb == NULL || !lua_getmetatable(L, idx))
+    return NULL;
+  luaL_getmetatable(L, LUA_STRBUFHANDLE);
+  if (!lua_rawequal(L, -1, -2))
+    sb = NULL;
+  lua_pop(L, 2);
+  if (sb == NULL)
+    return NULL;
+  if (len != NULL) *len = sb->n;
+  return (sb->b != NULL) ? sb->b : "";
+}
+
+
+static const luaL_Reg bufmethods[] = {
+  {"put", buf_put},
+  {"reserve", buf_reserve},
+  {"reset", buf_reset},
+  {"tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg strbuflib[] = {
+  {"new", buf_new},
+  {NULL, NULL}
+};
+
+
+static void createstrbufmeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_STRBUFHANDLE);  /* create metatable for buffers */
+  lua_newtable(L);  /* methods */
+  luaL_register(L, NULL, bufmethods);
+  lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+  lua_getfield(L, -1, LUA_STRLIBNAME);
+  if (lua_istable(L, -1))
+    lua_getfield(L, -1, "format");
+  else
+    lua_pushnil(L);
+  lua_pushcclosure(L, buf_putf, 1);
+  lua_setfield(L, -4, "putf");
+  lua_pop(L, 2);  /* `_LOADED' and string library */
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, buf_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, buf_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pop(L, 1);
+}
+
+
+/*
+** Open string buffer library
+*/
+LUALIB_API int luaopen_strbuf (lua_State *L) {
+  createstrbufmeta(L);
+  luaL_register(L, LUA_STRBUFLIBNAME, strbuflib);
+  return 1;
+}
+
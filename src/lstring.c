@@ -21,10 +21,30 @@
 #include "lstate.h"
 #include "lstring.h"
 
+/*
+** buckets moved at each string creation while the table is resized
+*/
+#define MIGRATESTEP	2
+
+
+/* value of `fixed' for the rope of an external string */
+#define ROPEEXTERNAL	2
+
+/* rope of an external string: how to give its bytes back */
+typedef struct ExtRope {
+  Rope r;
+  lua_Alloc falloc;
+  void *ud;
+} ExtRope;
+
+
 /*
   对保存string的hash桶进行resize
   字符串使用散列桶来存放数据，当数据量非常大时，分配到每个桶上的数据也会非常多，这样一次查找也退化成了一次线性查找过程。
   所以，在Lua中，当字符串数据非常多时，会重新分配桶的数量，降低每个桶上分配到的数据量。
+  The strings are not moved here: the old array is kept, and lookups
+  search both arrays while `luaS_migrate' moves its buckets a few at a
+  time (at each string creation and at each collector step).
 */
 void luaS_resize (lua_State *L, int newsize) {
   GCObject **newhash;
@@ -38,46 +58,130 @@ void luaS_resize (lua_State *L, int newsize) {
   newhash = luaM_newvector(L, newsize, GCObject *);
   tb = &G(L)->strt;
   for (i=0; i<newsize; i++) newhash[i] = NULL;
+  if (G(L)->gcstate == GCSsweepstring) {  /* collected while allocating? */
+    luaM_freearray(L, newhash, newsize, GCObject *);
+    return;
+  }
+  luaS_migrate(L, tb->oldsize);  /* finish previous resize */
+  lua_assert(tb->oldhash == NULL);
+  if (tb->size > 0) {
+    tb->oldhash = tb->hash;
+    tb->oldsize = tb->size;
+    tb->nmoved = 0;
+  }
+  tb->size = newsize;
+  tb->hash = newhash;
+}
+
 
-  /* rehash（重新散列） */
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
+/*
+** moves up to `n' buckets of the old array of the string table to the
+** new one (not while the collector sweeps strings: buckets already swept
+** would get strings not swept yet)
+*/
+void luaS_migrate (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->oldhash == NULL || G(L)->gcstate == GCSsweepstring)
+    return;
+  for (; n > 0 && tb->nmoved < tb->oldsize; n--) {
+    GCObject *p = tb->oldhash[tb->nmoved];
+    tb->oldhash[tb->nmoved++] = NULL;
     while (p) {  /* for each node in the list */
       GCObject *next = p->gch.next;  /* save next */
       unsigned int h = gco2ts(p)->hash;
       // 重新计算hash桶索引，这次需要mod新的hash桶大小
-      int h1 = lmod(h, newsize);  /* new position */
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* chain it */
-      newhash[h1] = p;
+      int h1 = lmod(h, tb->size);  /* new position */
+      lua_assert(cast_int(h%tb->size) == lmod(h, tb->size));
+      p->gch.next = tb->hash[h1];  /* chain it */
+      tb->hash[h1] = p;
       p = next;
     }
   }
-  /* 释放旧的散列桶，保存新分配的散列桶数据 */
-  luaM_freearray(L, tb->hash, tb->size, TString *);
-  tb->size = newsize;
-  tb->hash = newhash;
+  if (tb->nmoved == tb->oldsize) {  /* all moved? */
+    global_State *g = G(L);
+    lu_mem freed = cast(lu_mem, tb->oldsize) * sizeof(GCObject *);
+    /* 释放旧的散列桶 */
+    luaM_freearray(L, tb->oldhash, tb->oldsize, GCObject *);
+    /* the collector may have counted it as live memory */
+    g->estimate = (g->estimate > freed) ? g->estimate - freed : 0;
+    tb->oldhash = NULL;
+    tb->oldsize = 0;
+    tb->nmoved = 0;
+  }
 }
 
-/* 创建一个新的字符串 */
-static TString *newlstr (lua_State *L, const char *str, size_t l, unsigned int h) {
+
+static TString *createstr (lua_State *L, const char *str, size_t l) {
   TString *ts;
-  stringtable *tb;
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
     luaM_toobig(L);
-  ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
+  ts = cast(TString *, luaM_newobject(L, LUA_TSTRING,
+                                      (l+1)*sizeof(char)+sizeof(TString)));
   ts->tsv.len = l;
-  ts->tsv.hash = h;
-  ts->tsv.marked = luaC_white(G(L));
-  ts->tsv.tt = LUA_TSTRING;
   ts->tsv.reserved = 0;
   memcpy(ts+1, str, l*sizeof(char));
   ((char *)(ts+1))[l] = '\0';  /* ending 0 */
+  return ts;
+}
+
+
+/*
+** Seeded hash of all the characters of a string (the mixing steps are
+** those of MurmurHash3). It reads four characters at a time; a string
+** that differs from another anywhere gets an unrelated hash, and the
+** seed keeps hashes unpredictable from outside.
+*/
+#define rotl(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define mixword(k) \
+  ((k) *= 0xcc9e2d51u, (k) = rotl(k, 15), (k) *= 0x1b873593u)
+
+unsigned int luaS_hashbytes (const char *str, size_t l, unsigned int seed) {
+  lu_int32 h = cast(lu_int32, seed ^ cast(unsigned int, l));
+  lu_int32 k;
+  for (; l >= 4; str += 4, l -= 4) {
+    memcpy(&k, str, 4);
+    mixword(k);
+    h ^= k;
+    h = rotl(h, 13);
+    h = h * 5 + 0xe6546b64u;
+  }
+  if (l > 0) {  /* tail */
+    k = 0;
+    switch (l) {
+      case 3: k ^= cast(lu_int32, cast(unsigned char, str[2])) << 16;
+        /* FALLTHROUGH */
+      case 2: k ^= cast(lu_int32, cast(unsigned char, str[1])) << 8;
+        /* FALLTHROUGH */
+      default: k ^= cast(unsigned char, str[0]);
+    }
+    mixword(k);
+    h ^= k;
+  }
+  h ^= h >> 16;  /* final mix */
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return cast(unsigned int, h);
+}
+
+
+/* 创建一个新的字符串 */
+static TString *newlstr (lua_State *L, const char *str, size_t l, unsigned int h) {
+  TString *ts = createstr(L, str, l);
+  stringtable *tb;
+  ts->tsv.hash = h;
+  ts->tsv.extra = STRHASHED;
+  ts->tsv.marked = luaC_white(G(L));
+  ts->tsv.tt = LUA_TSTRING;
   tb = &G(L)->strt;
   h = lmod(h, tb->size);
   ts->tsv.next = tb->hash[h];  /* chain new entry */
   tb->hash[h] = obj2gco(ts);
   tb->nuse++;
+  luaC_recent(G(L), obj2gco(ts));
+  luaS_migrate(L, MIGRATESTEP);
   // 在hash桶数组大小小于MAX_INT/2的情况下，
   // 只要字符串数量大于桶数组数量就开始成倍的扩充桶的容量
   if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
@@ -85,6 +189,16 @@ static TString *newlstr (lua_State *L, const char *str, size_t l, unsigned int h
   return ts;
 }
 
+static GCObject *findstr (GCObject *o, const char *str, size_t l) {
+  for (; o != NULL; o = o->gch.next) {
+    TString *ts = rawgco2ts(o);
+    if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0))
+      return o;
+  }
+  return NULL;
+}
+
+
 /*
   1、计算需要新创建的字符串对应的散列值
   2、根据散列值找到对应的散列桶，遍历该散列桶的所有元素，如果能够查找到同样的字符串，
@@ -93,31 +207,266 @@ static TString *newlstr (lua_State *L, const char *str, size_t l, unsigned int h
 */
 TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
   GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  /* 计算散列值操作时的步长。为了在字符串非常大的时候，不需要逐位来进行散列值的计算，而仅需要每步长单位取一个字符就可以了 */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
-  size_t l1;
-  for (l1=l; l1>=step; l1-=step)  /* compute hash */
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
-       o != NULL;
-       o = o->gch.next) {
-    TString *ts = rawgco2ts(o);
-    if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
-      /* 判断这个字符串是否在当前GC阶段被判定为需要回收，如果是，
-      则调用changewhite函数修改它的状态，将其改为不需要进行回收，从而达到复用字符串的目的 */
-      if (isdead(G(L), o)) changewhite(o);
-      return ts;
-    }
+  unsigned int h;
+  if (l > LUAI_MAXSHORTLEN) {  /* long string? */
+    TString *ts = createstr(L, str, l);
+    ts->tsv.hash = G(L)->seed;  /* until its hash is needed */
+    ts->tsv.extra = 0;
+    luaC_link(L, obj2gco(ts), LUA_TSTRING);  /* not in the string table */
+    return ts;
+  }
+  h = luaS_hashbytes(str, l, G(L)->seed);
+  o = findstr(G(L)->strt.hash[lmod(h, G(L)->strt.size)], str, l);
+  if (o == NULL && G(L)->strt.oldhash != NULL)  /* not moved yet? */
+    o = findstr(G(L)->strt.oldhash[lmod(h, G(L)->strt.oldsize)], str, l);
+  if (o != NULL) {
+    /* 判断这个字符串是否在当前GC阶段被判定为需要回收，如果是，
+    则调用changewhite函数修改它的状态，将其改为不需要进行回收，从而达到复用字符串的目的 */
+    if (isdead(G(L), o)) changewhite(o);
+    luaC_recent(G(L), o);  /* may be held only by the caller now */
+    return rawgco2ts(o);
   }
   return newlstr(L, str, l, h);  /* not found */
 }
 
 
+/*
+** hash of a long string, computed the first time it is needed (until
+** then, `hash' keeps the seed of its state)
+*/
+unsigned int luaS_hashlong (TString *ts) {
+  if (!(ts->tsv.extra & STRHASHED)) {
+    ts->tsv.hash = luaS_hashbytes(getstr(ts), ts->tsv.len, ts->tsv.hash);
+    ts->tsv.extra |= STRHASHED;
+  }
+  return ts->tsv.hash;
+}
+
+
+int luaS_eqlngstr (const TString *a, const TString *b) {
+  size_t len = a->tsv.len;
+  return (len == b->tsv.len && memcmp(getstr(a), getstr(b), len) == 0);
+}
+
+
+/*
+** header of a rope string; it has no buffer yet, so an error while
+** building the string leaves nothing to leak
+*/
+static TString *newropestr (lua_State *L) {
+  TString *ts = cast(TString *, luaM_newobject(L, LUA_TSTRING,
+                                      sizeof(TString)+sizeof(Rope *)));
+  ts->tsv.len = 0;
+  ts->tsv.reserved = 0;
+  ts->tsv.extra = STRROPE;
+  ts->tsv.hash = G(L)->seed;  /* until its hash is needed */
+  ropeof(ts) = NULL;
+  luaC_link(L, obj2gco(ts), LUA_TSTRING);
+  return ts;
+}
+
+
+static void freerope (lua_State *L, Rope *r) {
+  if (r->fixed == ROPEEXTERNAL) {
+    ExtRope *e = cast(ExtRope *, r);
+    if (e->falloc != NULL)
+      (*e->falloc)(e->ud, r->data, r->size, 0);
+    G(L)->nexternal--;
+    luaM_free(L, e);
+  }
+  else if (r->data == cast(char *, r + 1))  /* copy made by `luaS_cstr'? */
+    luaM_freemem(L, r, sizeof(Rope) + r->size);
+  else {
+    luaM_freearray(L, r->data, r->size, char);
+    luaM_free(L, r);
+  }
+}
+
+
+/*
+** Concatenates the `n' strings in `v' (`l' characters in all) into a
+** rope string. When the first one is the longest string of a buffer
+** that may still grow, the others are appended to that buffer, which
+** doubles when full; so `s = s .. x' in a loop copies each piece about
+** once instead of copying the whole `s' each time.
+*/
+TString *luaS_concat (lua_State *L, const TValue *v, int n, size_t l) {
+  TString *first = rawtsvalue(v);
+  TString *ts;
+  Rope *r;
+  size_t tl;
+  int i;
+  lua_assert(l > LUAI_MAXSHORTLEN);
+  if (isrope(first) && !(r = ropeof(first))->fixed &&
+      r->used == first->tsv.len) {  /* can append to its buffer? */
+    if (l >= r->size) {
+      size_t newsize = (r->size <= (MAX_SIZET - 1)/2 && 2*r->size > l) ?
+                       2*r->size : l+1;
+      luaM_reallocvector(L, r->data, r->size, newsize, char);
+      r->size = newsize;
+    }
+    ts = newropestr(L);
+    ropeof(ts) = r;
+    r->nstrings++;
+    tl = r->used;
+    i = 1;  /* first string is already there */
+  }
+  else {
+    if (l+1 > MAX_SIZET/sizeof(char))
+      luaM_toobig(L);
+    ts = newropestr(L);
+    r = luaM_new(L, Rope);
+    r->data = NULL;
+    r->used = r->size = 0;
+    r->nstrings = 1;
+    r->fixed = 0;
+    ropeof(ts) = r;
+    r->data = luaM_newvector(L, l+1, char);
+    r->size = l+1;
+    tl = 0;
+    i = 0;
+  }
+  for (; i < n; i++) {
+    size_t sl = tsvalue(v+i)->len;
+    memcpy(r->data+tl, svalue(v+i), sl);  /* may come from `r' itself */
+    tl += sl;
+  }
+  lua_assert(tl == l);
+  r->data[l] = '\0';
+  r->used = l;
+  ts->tsv.len = l;
+  return ts;
+}
+
+
+/*
+** Contents of `ts' ended by a '\0', which stay in place while `ts'
+** lives: a rope string gets a buffer of its own (the one it uses, if
+** no other string uses it), and that buffer is fixed.
+*/
+const char *luaS_cstr (lua_State *L, TString *ts) {
+  Rope *r;
+  size_t l = ts->tsv.len;
+  if (!isrope(ts) || (r = ropeof(ts))->fixed)
+    return getstr(ts);
+  if (r->nstrings == 1) {  /* only user? */
+    if (r->size > l+1) {  /* drop what is left of longer strings */
+      luaM_reallocvector(L, r->data, r->size, l+1, char);
+      r->size = l+1;
+    }
+  }
+  else {
+    Rope *nr = cast(Rope *, luaM_malloc(L, sizeof(Rope) + (l+1)));
+    nr->data = cast(char *, nr + 1);
+    memcpy(nr->data, r->data, l);
+    nr->size = l+1;
+    nr->nstrings = 1;
+    if (--r->nstrings == 0)  /* others collected while allocating? */
+      freerope(L, r);
+    ropeof(ts) = r = nr;
+  }
+  r->data[l] = '\0';
+  r->used = l;
+  r->fixed = 1;
+  return r->data;
+}
+
+
+/*
+** `luaO_str2d' for strings that may be ropes: the characters after a
+** rope string may belong to a longer one, so it is ended meanwhile
+*/
+int luaS_str2d (TString *ts, lua_Number *result) {
+  if (isrope(ts) && !ropeof(ts)->fixed) {  /* (fixed ones are ended) */
+    char *end = ropeof(ts)->data + ts->tsv.len;
+    char c = *end;
+    int res;
+    *end = '\0';
+    res = luaO_str2d(ropeof(ts)->data, result);
+    *end = c;
+    return res;
+  }
+  return luaO_str2d(getstr(ts), result);
+}
+
+
+void luaS_freerope (lua_State *L, TString *ts) {
+  Rope *r = ropeof(ts);
+  if (r != NULL && --r->nstrings == 0)
+    freerope(L, r);
+}
+
+
+/*
+** bytes held by `ts'; a rope buffer is split among the strings using
+** it (an external one counts the host's bytes too)
+*/
+size_t luaS_bytes (TString *ts) {
+  Rope *r;
+  size_t rb;
+  if (!isrope(ts) || (r = ropeof(ts)) == NULL)
+    return sizestring(&ts->tsv);
+  rb = ((r->fixed == ROPEEXTERNAL) ? sizeof(ExtRope) : sizeof(Rope)) + r->size;
+  return sizestring(&ts->tsv) + rb / r->nstrings;
+}
+
+
+/*
+** string whose bytes are the host's `l' bytes at `s' (followed by a
+** '\0'), given back through `falloc' when it is collected. Short strings
+** must be interned, so they are copied and `s' is given back at once.
+*/
+TString *luaS_newextlstr (lua_State *L, const char *s, size_t l,
+                          lua_Alloc falloc, void *ud) {
+  TString *ts;
+  ExtRope *e;
+  if (l <= LUAI_MAXSHORTLEN) {
+    ts = luaS_newlstr(L, s, l);
+    if (falloc != NULL)
+      (*falloc)(ud, cast(void *, s), l+1, 0);
+    return ts;
+  }
+  ts = newropestr(L);
+  e = luaM_new(L, ExtRope);
+  e->r.data = cast(char *, s);  /* never written: it is fixed */
+  e->r.used = l;
+  e->r.size = l+1;
+  e->r.nstrings = 1;
+  e->r.fixed = ROPEEXTERNAL;
+  e->falloc = falloc;
+  e->ud = ud;
+  ropeof(ts) = &e->r;
+  ts->tsv.len = l;
+  G(L)->nexternal++;
+  return ts;
+}
+
+
+/*
+** gives back the bytes of all external strings, for a state closed
+** without freeing its objects one by one
+*/
+void luaS_freeexternal (lua_State *L) {
+  GCObject *o;
+  for (o = G(L)->rootgc; o != NULL; o = o->gch.next) {
+    if (o->gch.tt == LUA_TSTRING && isrope(rawgco2ts(o))) {
+      Rope *r = ropeof(rawgco2ts(o));
+      if (r != NULL && r->fixed == ROPEEXTERNAL) {
+        ExtRope *e = cast(ExtRope *, r);
+        if (e->falloc != NULL)
+          (*e->falloc)(e->ud, r->data, r->size, 0);
+      }
+    }
+  }
+  G(L)->nexternal = 0;
+}
+
+
 Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
   if (s > MAX_SIZET - sizeof(Udata))
     luaM_toobig(L);
-  Udata* u = cast(Udata*, luaM_malloc(L, s + sizeof(Udata)));
+  Udata* u = cast(Udata*, luaM_newobject(L, LUA_TUSERDATA,
+                                          s + sizeof(Udata)));
   u->uv.marked = luaC_white(G(L));  /* is not finalized */
   u->uv.tt = LUA_TUSERDATA;
   u->uv.len = s;
@@ -133,6 +482,7 @@ Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
    */
   u->uv.next = G(L)->mainthread->next;
   G(L)->mainthread->next = obj2gco(u);
+  luaC_recent(G(L), obj2gco(u));
   return u;
 }
 
@@ -13,7 +13,9 @@
 #include "lstate.h"
 
 
-#define sizestring(s)	(sizeof(union TString)+((s)->len+1)*sizeof(char))
+#define sizestring(s)	(((s)->extra & STRROPE) ? \
+	sizeof(union TString)+sizeof(Rope *) : \
+	sizeof(union TString)+((s)->len+1)*sizeof(char))
 
 #define sizeudata(u)	(sizeof(union Udata)+(u)->len)
 
@@ -24,9 +26,45 @@
 // 标记这个GC对象不可回收
 #define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
 
+/*
+** only short strings are interned; a long string gets its hash when it
+** is first used as a table key
+*/
+#define isshortstr(ts)	((ts)->tsv.len <= LUAI_MAXSHORTLEN)
+
+#define luaS_hash(ts) \
+	(((ts)->tsv.extra & STRHASHED) ? (ts)->tsv.hash : luaS_hashlong(ts))
+
+#define isrope(ts)	((ts)->tsv.extra & STRROPE)
+
+#define luaS_eqstr(a,b) \
+	((a) == (b) || (!isshortstr(a) && luaS_eqlngstr(a, b)))
+
+/*
+** buckets of the string table; while it is resized, those of the old
+** array follow those of the new one
+*/
+#define luaS_nbuckets(tb)	((tb)->size + (tb)->oldsize)
+#define luaS_bucket(tb,i) \
+	((i) < (tb)->size ? &(tb)->hash[i] : &(tb)->oldhash[(i) - (tb)->size])
+
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_migrate (lua_State *L, int n);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC unsigned int luaS_hashbytes (const char *str, size_t l,
+                                       unsigned int seed);
+LUAI_FUNC unsigned int luaS_hashlong (TString *ts);
+LUAI_FUNC int luaS_eqlngstr (const TString *a, const TString *b);
+LUAI_FUNC TString *luaS_concat (lua_State *L, const TValue *v, int n,
+                                size_t l);
+LUAI_FUNC const char *luaS_cstr (lua_State *L, TString *ts);
+LUAI_FUNC int luaS_str2d (TString *ts, lua_Number *result);
+LUAI_FUNC void luaS_freerope (lua_State *L, TString *ts);
+LUAI_FUNC size_t luaS_bytes (TString *ts);
+LUAI_FUNC TString *luaS_newextlstr (lua_State *L, const char *s, size_t l,
+                                    lua_Alloc falloc, void *ud);
+LUAI_FUNC void luaS_freeexternal (lua_State *L);
 
 
 #endif
@@ -7,6 +7,8 @@
 
 
 #include <ctype.h>
+#include <limits.h>
+#include <locale.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -202,19 +204,26 @@ static int capture_to_close (MatchState *ms) {
   return luaL_error(ms->L, "invalid pattern capture");
 }
 
-// 返回分类的结束字符
-static const char *classend (MatchState *ms, const char *p) {
+/*
+** end of the class at `p'; NULL (and the error in `err') when the
+** pattern is malformed
+*/
+static const char *classlimit (const char *p, const char **err) {
   switch (*p++) {
     case L_ESC: {
-      if (*p == '\0')
-        luaL_error(ms->L, "malformed pattern (ends with " LUA_QL("%%") ")");
+      if (*p == '\0') {
+        *err = "malformed pattern (ends with " LUA_QL("%") ")";
+        return NULL;
+      }
       return p+1;
     }
     case '[': {
       if (*p == '^') p++;
       do {  /* look for a `]' */
-        if (*p == '\0')
-          luaL_error(ms->L, "malformed pattern (missing " LUA_QL("]") ")");
+        if (*p == '\0') {
+          *err = "malformed pattern (missing " LUA_QL("]") ")";
+          return NULL;
+        }
         if (*(p++) == L_ESC && *p != '\0')
           p++;  /* skip escapes (e.g. `%]') */
       } while (*p != ']');
@@ -226,6 +235,16 @@ static const char *classend (MatchState *ms, const char *p) {
   }
 }
 
+
+// 返回分类的结束字符
+static const char *classend (MatchState *ms, const char *p) {
+  const char *err;
+  const char *ep = classlimit(p, &err);
+  if (ep == NULL)
+    luaL_error(ms->L, "%s", err);
+  return ep;
+}
+
 // 匹配类型
 static int match_class (int c, int cl) {
   int res;
@@ -478,6 +497,583 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** A pattern is compiled into a program of instructions, one for each
+** item of the pattern; single character classes become sets of 256
+** bits and runs of plain characters become literal strings.
+** `cmatch' runs a program exactly as `match' interprets its source.
+*/
+
+enum {
+  P_END,  /* end of the pattern: match succeeded */
+  P_EOS,  /* `$' at the end of the pattern */
+  P_OPEN,  /* `(' */
+  P_POSITION,  /* `()' */
+  P_CLOSE,  /* `)' */
+  P_BALANCE,  /* `%bxy' ('x' and 'y' in `x') */
+  P_FRONTIER,  /* `%f[set]' */
+  P_BACKREF,  /* `%1' to `%9' (the digit in `arg') */
+  P_LITERAL,  /* `arg' plain characters (in `x') */
+  P_ONE,  /* a single character class (the set in `x') */
+  P_OPT,  /* a class followed by `?' */
+  P_STAR,  /* a class followed by `*' */
+  P_PLUS,  /* a class followed by `+' */
+  P_MIN  /* a class followed by `-' */
+};
+
+
+typedef struct PInst {
+  int op;
+  int arg;
+  const unsigned char *x;
+} PInst;
+
+
+typedef struct Pattern {
+  const PInst *code;  /* program for `find', `match' and `gsub' */
+  const PInst *gcode;  /* program for `gmatch' (where `^' is not special) */
+  int anchor;  /* does the pattern start with `^'? */
+  int plain;  /* has it no special characters? (see `str_find_aux') */
+  int ctype;  /* do its sets depend on the locale? */
+  const char *src;  /* source of the pattern */
+  size_t len;
+  /* followed by the instructions, the sets, the literals and `src' */
+} Pattern;
+
+
+#define PATTERNHANDLE	"PATTERN*"
+
+#define SETSIZE		(UCHAR_MAX/8 + 1)
+
+#define inset(x,c)	((x)[(c) >> 3] & (1 << ((c) & 7)))
+
+
+typedef struct CompState {
+  const char *err;  /* error in the pattern (or NULL) */
+  int ninst;
+  int nsets;
+  size_t ntext;
+  PInst *code;  /* NULL in the first pass, which only counts */
+  unsigned char *sets;
+  char *text;
+  ptrdiff_t lit;  /* start in `text' of the pending literal (or -1) */
+  PInst dummy;  /* instruction written in the first pass */
+} CompState;
+
+
+static PInst *addinst (CompState *cs, int op, int arg) {
+  PInst *i = (cs->code != NULL) ? &cs->code[cs->ninst] : &cs->dummy;
+  cs->ninst++;
+  i->op = op;
+  i->arg = arg;
+  i->x = NULL;
+  return i;
+}
+
+
+static const unsigned char *addset (CompState *cs, const unsigned char *set) {
+  unsigned char *x = NULL;
+  if (cs->sets != NULL) {
+    x = cs->sets + cs->nsets * SETSIZE;
+    memcpy(x, set, SETSIZE);
+  }
+  cs->nsets++;
+  return x;
+}
+
+
+static void addtext (CompState *cs, int c) {
+  if (cs->text != NULL)
+    cs->text[cs->ntext] = (char)c;
+  cs->ntext++;
+}
+
+
+/* ends the pending run of plain characters */
+static void closeliteral (CompState *cs) {
+  if (cs->lit >= 0) {
+    PInst *i = addinst(cs, P_LITERAL, (int)(cs->ntext - cs->lit));
+    if (cs->text != NULL)
+      i->x = (const unsigned char *)cs->text + cs->lit;
+    cs->lit = -1;
+  }
+}
+
+
+/*
+** compiles the pattern `p' following the cases of `match'; the sets
+** come from `singlematch' and `matchbracketclass' themselves
+*/
+static void compileview (CompState *cs, const char *p) {
+  unsigned char set[SETSIZE];
+  cs->lit = -1;
+  for (;;) {
+    const char *ep;
+    int c, n, last, op;
+    switch (*p) {
+      case '(': {
+        closeliteral(cs);
+        if (*(p+1) == ')') {
+          addinst(cs, P_POSITION, 0);
+          p += 2;
+        }
+        else {
+          addinst(cs, P_OPEN, 0);
+          p++;
+        }
+        continue;
+      }
+      case ')': {
+        closeliteral(cs);
+        addinst(cs, P_CLOSE, 0);
+        p++;
+        continue;
+      }
+      case '\0': {
+        closeliteral(cs);
+        addinst(cs, P_END, 0);
+        return;
+      }
+      case '$': {
+        if (*(p+1) == '\0') {
+          closeliteral(cs);
+          addinst(cs, P_EOS, 0);
+          return;
+        }
+        break;
+      }
+      case L_ESC: {
+        if (*(p+1) == 'b') {
+          PInst *i;
+          if (*(p+2) == '\0' || *(p+3) == '\0') {
+            cs->err = "unbalanced pattern";
+            return;
+          }
+          closeliteral(cs);
+          i = addinst(cs, P_BALANCE, 0);
+          addtext(cs, *(p+2));
+          addtext(cs, *(p+3));
+          if (cs->text != NULL)
+            i->x = (const unsigned char *)cs->text + cs->ntext - 2;
+          p += 4;
+          continue;
+        }
+        else if (*(p+1) == 'f') {
+          p += 2;
+          if (*p != '[') {
+            cs->err = "missing " LUA_QL("[") " after " LUA_QL("%f")
+                      " in pattern";
+            return;
+          }
+          if ((ep = classlimit(p, &cs->err)) == NULL) return;
+          for (c = 0; c <= UCHAR_MAX; c++) {
+            if (matchbracketclass(c, p, ep-1)) set[c >> 3] |= 1 << (c & 7);
+            else set[c >> 3] &= ~(1 << (c & 7));
+          }
+          closeliteral(cs);
+          addinst(cs, P_FRONTIER, 0)->x = addset(cs, set);
+          p = ep;
+          continue;
+        }
+        else if (isdigit(uchar(*(p+1)))) {
+          closeliteral(cs);
+          addinst(cs, P_BACKREF, uchar(*(p+1)));
+          p += 2;
+          continue;
+        }
+        break;
+      }
+    }
+    /* a single character class */
+    if ((ep = classlimit(p, &cs->err)) == NULL) return;
+    n = 0;
+    last = 0;
+    for (c = 0; c <= UCHAR_MAX; c++) {
+      if (singlematch(c, p, ep)) {
+        set[c >> 3] |= 1 << (c & 7);
+        n++;
+        last = c;
+      }
+      else set[c >> 3] &= ~(1 << (c & 7));
+    }
+    switch (*ep) {
+      case '?': op = P_OPT; break;
+      case '*': op = P_STAR; break;
+      case '+': op = P_PLUS; break;
+      case '-': op = P_MIN; break;
+      default: op = P_ONE; break;
+    }
+    if (op == P_ONE && n == 1) {  /* a plain character? */
+      if (cs->lit < 0) cs->lit = (ptrdiff_t)cs->ntext;
+      addtext(cs, last);
+      p = ep;
+    }
+    else {
+      closeliteral(cs);
+      addinst(cs, op, 0)->x = addset(cs, set);
+      p = (op == P_ONE) ? ep : ep+1;
+    }
+  }
+}
+
+
+/*
+** does the pattern use classes whose sets depend on the locale? (`%d',
+** `%x' and `%z' do not)
+*/
+static int usesctype (const char *p) {
+  while ((p = strchr(p, L_ESC)) != NULL && *(p+1) != '\0') {
+    if (strchr("aclpsuw", tolower(uchar(*(p+1)))) != NULL)
+      return 1;
+    p += 2;
+  }
+  return 0;
+}
+
+
+/*
+** compiles the pattern at `arg' into a new userdata; when the pattern is
+** malformed returns NULL (and pushes nothing) with the error in `err'
+*/
+static Pattern *compilepattern (lua_State *L, int arg, const char **err) {
+  size_t l;
+  const char *p = lua_tolstring(L, arg, &l);
+  int anchor = (*p == '^');
+  int ncode;
+  CompState cs;
+  Pattern *pt;
+  char *src;
+  cs.err = NULL;
+  cs.ninst = cs.nsets = 0;
+  cs.ntext = 0;
+  cs.code = NULL; cs.sets = NULL; cs.text = NULL;
+  compileview(&cs, p + anchor);  /* count */
+  if (anchor && cs.err == NULL)
+    compileview(&cs, p);  /* `gmatch' sees the `^' as a character */
+  if (cs.err != NULL) {
+    *err = cs.err;
+    return NULL;
+  }
+  pt = (Pattern *)lua_newuserdata(L, sizeof(Pattern) +
+                                     cs.ninst * sizeof(PInst) +
+                                     cs.nsets * SETSIZE + cs.ntext + l + 1);
+  cs.code = (PInst *)(pt + 1);
+  cs.sets = (unsigned char *)(cs.code + cs.ninst);
+  cs.text = (char *)(cs.sets + cs.nsets * SETSIZE);
+  src = cs.text + cs.ntext;
+  cs.ninst = cs.nsets = 0;
+  cs.ntext = 0;
+  compileview(&cs, p + anchor);
+  ncode = cs.ninst;
+  if (anchor)
+    compileview(&cs, p);
+  memcpy(src, p, l + 1);
+  pt->code = cs.code;
+  pt->gcode = cs.code + (anchor ? ncode : 0);
+  pt->anchor = anchor;
+  pt->plain = (strpbrk(src, SPECIALS) == NULL);
+  pt->ctype = usesctype(src);
+  pt->src = src;
+  pt->len = l;
+  luaL_getmetatable(L, PATTERNHANDLE);
+  lua_setmetatable(L, -2);
+  return pt;
+}
+
+
+/*
+** first position from `s' where the program `pc' may match (or the
+** end of the subject), skipping those that its first item rejects
+*/
+static const char *cskip (MatchState *ms, const char *s, const PInst *pc) {
+  switch (pc->op) {
+    case P_LITERAL: {
+      const char *f = (const char *)memchr(s, pc->x[0], ms->src_end - s);
+      return (f != NULL) ? f : ms->src_end;
+    }
+    case P_ONE: case P_PLUS: {
+      while (s < ms->src_end && !inset(pc->x, uchar(*s))) s++;
+      return s;
+    }
+    default: return s;
+  }
+}
+
+
+/* can `pc' match at `s'? (a quick test of its first character) */
+#define mayfollow(ms,s,pc) \
+	(((pc)->op != P_LITERAL || ((s) < (ms)->src_end && \
+	                             uchar(*(s)) == (pc)->x[0])) && \
+	 ((pc)->op != P_ONE || ((s) < (ms)->src_end && \
+	                         inset((pc)->x, uchar(*(s))))))
+
+
+static const char *cmatch (MatchState *ms, const char *s, const PInst *pc);
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                  const PInst *pc) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  while ((s+i)<ms->src_end && inset(pc->x, uchar(*(s+i))))
+    i++;
+  /* keeps trying to match with the maximum repetitions */
+  for (pc++; i>=0; i--) {
+    if (mayfollow(ms, s+i, pc)) {
+      const char *res = cmatch(ms, (s+i), pc);
+      if (res) return res;
+    }
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                  const PInst *pc) {
+  for (;;) {
+    const char *res = cmatch(ms, s, pc+1);
+    if (res != NULL)
+      return res;
+    else if (s<ms->src_end && inset(pc->x, uchar(*s)))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                     const PInst *pc, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=cmatch(ms, s, pc)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                   const PInst *pc) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, pc)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s, const PInst *pc) {
+  init: /* using goto's to optimize tail recursion */
+  switch (pc->op) {
+    case P_END: {
+      return s;  /* match succeeded */
+    }
+    case P_EOS: {
+      return (s == ms->src_end) ? s : NULL;  /* check end of string */
+    }
+    case P_OPEN: {
+      return cstart_capture(ms, s, pc+1, CAP_UNFINISHED);
+    }
+    case P_POSITION: {
+      return cstart_capture(ms, s, pc+1, CAP_POSITION);
+    }
+    case P_CLOSE: {
+      return cend_capture(ms, s, pc+1);
+    }
+    case P_BALANCE: {
+      s = matchbalance(ms, s, (const char *)pc->x);
+      if (s == NULL) return NULL;
+      pc++; goto init;
+    }
+    case P_FRONTIER: {
+      int previous = (s == ms->src_init) ? '\0' : uchar(*(s-1));
+      if (inset(pc->x, previous) || !inset(pc->x, uchar(*s))) return NULL;
+      pc++; goto init;
+    }
+    case P_BACKREF: {
+      s = match_capture(ms, s, pc->arg);
+      if (s == NULL) return NULL;
+      pc++; goto init;
+    }
+    case P_LITERAL: {
+      size_t n = (size_t)pc->arg;
+      if ((size_t)(ms->src_end - s) < n || uchar(*s) != pc->x[0] ||
+          (n > 1 && memcmp(s + 1, pc->x + 1, n - 1) != 0))
+        return NULL;
+      s += n; pc++; goto init;
+    }
+    case P_ONE: {
+      if (s >= ms->src_end || !inset(pc->x, uchar(*s))) return NULL;
+      s++; pc++; goto init;
+    }
+    case P_OPT: {
+      const char *res;
+      if (s < ms->src_end && inset(pc->x, uchar(*s)) &&
+          (res = cmatch(ms, s+1, pc+1)) != NULL)
+        return res;
+      pc++; goto init;
+    }
+    case P_STAR: {
+      return cmax_expand(ms, s, pc);
+    }
+    case P_PLUS: {
+      return (s < ms->src_end && inset(pc->x, uchar(*s))) ?
+             cmax_expand(ms, s+1, pc) : NULL;
+    }
+    default: {  /* P_MIN */
+      return cmin_expand(ms, s, pc);
+    }
+  }
+}
+
+
+/*
+** The programs of the last patterns used by `find', `match', `gmatch'
+** and `gsub' (an upvalue of them), keyed by the address of the pattern
+** string: the string and the program are kept in the environment of
+** the cache, so while an entry is there its address cannot be reused.
+** As the sets of classes such as `%a' depend on the locale, the cache
+** is emptied when the LC_CTYPE locale changes; this is checked when
+** compiling and when using programs with such classes.
+*/
+typedef struct PatCache {
+  const char *locale;  /* LC_CTYPE locale of the programs (or NULL) */
+  unsigned long clock;  /* counts uses, to find the least recently used */
+  struct {
+    const char *key;  /* pattern string (or NULL) */
+    size_t len;
+    unsigned long used;  /* `clock' at its last use */
+    Pattern *pt;
+  } e[LUA_PATTERNCACHE];
+} PatCache;
+
+
+/* empties the cache when the LC_CTYPE locale changed */
+static void checklocale (lua_State *L, PatCache *c) {
+  const char *locale = setlocale(LC_CTYPE, NULL);
+  int i;
+  if (locale == NULL ||
+      (c->locale != NULL && strcmp(locale, c->locale) == 0))
+    return;  /* locale did not change */
+  lua_getfenv(L, lua_upvalueindex(1));
+  for (i = 0; i < LUA_PATTERNCACHE; i++) {
+    c->e[i].key = NULL;
+    c->e[i].used = 0;
+    lua_pushnil(L);
+    lua_rawseti(L, -2, 2*i + 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, 2*i + 2);
+  }
+  lua_pushstring(L, locale);
+  c->locale = lua_tostring(L, -1);
+  lua_rawseti(L, -2, 2*LUA_PATTERNCACHE + 1);  /* keep the name */
+  lua_pop(L, 1);
+}
+
+
+/*
+** program of the pattern string `p' (of length `l', at `arg'), from the
+** cache or compiled (NULL for a malformed pattern, which is then
+** interpreted so that its errors come as it is matched); if `keep',
+** also pushes the program (or nil) to keep it alive
+*/
+static Pattern *cachedpattern (lua_State *L, int arg, const char *p,
+                               size_t l, int keep) {
+  PatCache *c = (PatCache *)lua_touserdata(L, lua_upvalueindex(1));
+  const char *err;
+  Pattern *pt;
+  int i, lru = 0;
+  if (c == NULL) {  /* not called from the library? */
+    if (keep) lua_pushnil(L);
+    return NULL;
+  }
+  for (i = 0; i < LUA_PATTERNCACHE; i++) {
+    if (c->e[i].key == p && c->e[i].len == l) {  /* hit? */
+      if (c->e[i].pt->ctype) checklocale(L, c);
+      if (c->e[i].key == NULL) break;  /* cache was emptied */
+      c->e[i].used = ++c->clock;
+      if (keep) {
+        lua_getfenv(L, lua_upvalueindex(1));
+        lua_rawgeti(L, -1, 2*i + 2);
+        lua_remove(L, -2);
+      }
+      return c->e[i].pt;
+    }
+  }
+  checklocale(L, c);
+  for (i = 1; i < LUA_PATTERNCACHE; i++) {
+    if (c->e[i].used < c->e[lru].used) lru = i;
+  }
+  if ((pt = compilepattern(L, arg, &err)) == NULL) {
+    if (keep) lua_pushnil(L);
+    return NULL;
+  }
+  lua_getfenv(L, lua_upvalueindex(1));
+  lua_pushvalue(L, arg);
+  lua_rawseti(L, -2, 2*lru + 1);  /* keep the key alive */
+  lua_pushvalue(L, -2);
+  lua_rawseti(L, -2, 2*lru + 2);
+  lua_pop(L, keep ? 1 : 2);
+  c->e[lru].key = p;
+  c->e[lru].len = l;
+  c->e[lru].used = ++c->clock;
+  c->e[lru].pt = pt;
+  return pt;
+}
+
+
+/* the compiled pattern at `arg' (or NULL) */
+static Pattern *topattern (lua_State *L, int arg) {
+  Pattern *pt = (Pattern *)lua_touserdata(L, arg);
+  if (pt == NULL || !lua_getmetatable(L, arg))
+    return NULL;
+  luaL_getmetatable(L, PATTERNHANDLE);
+  if (!lua_rawequal(L, -1, -2))
+    pt = NULL;
+  lua_pop(L, 2);
+  return pt;
+}
+
+
+/*
+** program of the pattern at `arg', a compiled pattern or a string (as
+** in `cachedpattern'); NULL when the string must be interpreted
+*/
+static Pattern *getpattern (lua_State *L, int arg, int keep) {
+  if (lua_type(L, arg) == LUA_TUSERDATA) {
+    Pattern *pt = topattern(L, arg);
+    if (pt == NULL)
+      luaL_typerror(L, arg, "string");
+    if (keep) lua_pushvalue(L, arg);
+    return pt;
+  }
+  else {
+    size_t l;
+    const char *p = luaL_checklstring(L, arg, &l);
+    return cachedpattern(L, arg, p, l, keep);
+  }
+}
+
+
+static int str_compile (lua_State *L) {
+  const char *err;
+  luaL_checkstring(L, 1);
+  if (compilepattern(L, 1, &err) == NULL)
+    luaL_error(L, "%s", err);
+  return 1;
+}
+
+
+static int pattern_tostring (lua_State *L) {
+  Pattern *pt = (Pattern *)luaL_checkudata(L, 1, PATTERNHANDLE);
+  lua_pushlstring(L, pt->src, pt->len);
+  return 1;
+}
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
@@ -537,13 +1133,21 @@ static int str_find_aux (lua_State *L, int find) {
   // 获取源字符串，存入s，长度存入l1
   const char *s = luaL_checklstring(L, 1, &l1);
   // 获取pattern字符串，存入p，长度存入l2
-  const char *p = luaL_checklstring(L, 2, &l2);
-  ptrdiff_t init = posrelat(luaL_optinteger(L, 3, 1), l1) - 1;
+  Pattern *pt = topattern(L, 2);
+  const char *p;
+  ptrdiff_t init;
+  if (pt != NULL) {  /* a compiled pattern? */
+    p = pt->src;
+    l2 = pt->len;
+  }
+  else p = luaL_checklstring(L, 2, &l2);
+  init = posrelat(luaL_optinteger(L, 3, 1), l1) - 1;
   if (init < 0) init = 0;
   else if ((size_t)(init) > l1) init = (ptrdiff_t)l1;
   // 根据第四个参数判断是否不采用模式匹配
   if (find && (lua_toboolean(L, 4) ||  /* explicit request? */
-      strpbrk(p, SPECIALS) == NULL)) {  /* or no special characters? */
+      ((pt != NULL) ? pt->plain :  /* or no special characters? */
+                      strpbrk(p, SPECIALS) == NULL))) {
     /* do a plain search */
     // 不采用模式匹配走的是lmemfind函数
     const char *s2 = lmemfind(s+init, l1-init, p, l2);
@@ -555,15 +1159,24 @@ static int str_find_aux (lua_State *L, int find) {
   }
   else {
     MatchState ms;
-    int anchor = (*p == '^') ? (p++, 1) : 0;
+    int anchor;
     const char *s1=s+init;
+    const PInst *pc;
+    if (pt == NULL) pt = cachedpattern(L, 2, p, l2, 0);
+    pc = (pt != NULL) ? pt->code : NULL;
+    anchor = (*p == '^') ? (p++, 1) : 0;
     ms.L = L;
     ms.src_init = s;
     ms.src_end = s+l1;
     do {
       const char *res;
       ms.level = 0;
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if (pc != NULL) {
+        if (!anchor) s1 = cskip(&ms, s1, pc);
+        res = cmatch(&ms, s1, pc);
+      }
+      else res = match(&ms, s1, p);
+      if (res != NULL) {
         if (find) {
           // 将start位置push进去
           lua_pushinteger(L, s1-s+1);  /* start */
@@ -596,6 +1209,8 @@ static int gmatch_aux (lua_State *L) {
   MatchState ms;
   size_t ls;
   const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
+  Pattern *pt = (Pattern *)lua_touserdata(L, lua_upvalueindex(2));
+  const PInst *pc = (pt != NULL) ? pt->gcode : NULL;
   const char *p = lua_tostring(L, lua_upvalueindex(2));
   const char *src;
   ms.L = L;
@@ -606,7 +1221,12 @@ static int gmatch_aux (lua_State *L) {
        src++) {
     const char *e;
     ms.level = 0;
-    if ((e = match(&ms, src, p)) != NULL) {
+    if (pc != NULL) {
+      src = cskip(&ms, src, pc);
+      e = cmatch(&ms, src, pc);
+    }
+    else e = match(&ms, src, p);
+    if (e != NULL) {
       lua_Integer newstart = e-s;
       if (e == src) newstart++;  /* empty match? go at least one position */
       lua_pushinteger(L, newstart);
@@ -620,8 +1240,11 @@ static int gmatch_aux (lua_State *L) {
 
 static int gmatch (lua_State *L) {
   luaL_checkstring(L, 1);
-  luaL_checkstring(L, 2);
   lua_settop(L, 2);
+  if (getpattern(L, 2, 1) != NULL)
+    lua_replace(L, 2);  /* the iterator keeps the program */
+  else
+    lua_pop(L, 1);
   lua_pushinteger(L, 0);
   lua_pushcclosure(L, gmatch_aux, 3);
   return 1;
@@ -691,9 +1314,11 @@ static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
 static int str_gsub (lua_State *L) {
   size_t srcl;
   const char *src = luaL_checklstring(L, 1, &srcl);
-  const char *p = luaL_checkstring(L, 2);
   int  tr = lua_type(L, 3);
   int max_s = luaL_optint(L, 4, srcl+1);
+  Pattern *pt = getpattern(L, 2, 1);  /* kept in the stack */
+  const char *p = (pt != NULL) ? pt->src : lua_tostring(L, 2);
+  const PInst *pc = (pt != NULL) ? pt->code : NULL;
   int anchor = (*p == '^') ? (p++, 1) : 0;
   int n = 0;
   MatchState ms;
@@ -708,7 +1333,15 @@ static int str_gsub (lua_State *L) {
   while (n < max_s) {
     const char *e;
     ms.level = 0;
-    e = match(&ms, src, p);
+    if (pc != NULL) {
+      if (!anchor) {  /* copy what cannot start a match */
+        const char *start = cskip(&ms, src, pc);
+        luaL_addlstring(&b, src, start - src);
+        src = start;
+      }
+      e = cmatch(&ms, src, pc);
+    }
+    else e = match(&ms, src, p);
     if (e) {
       n++;
       add_value(&ms, &b, src, e);
@@ -872,15 +1505,12 @@ static int str_format (lua_State *L) {
 static const luaL_Reg strlib[] = {
   {"byte", str_byte},
   {"char", str_char},
+  {"compile", str_compile},
   {"dump", str_dump},
-  {"find", str_find},
   {"format", str_format},
   {"gfind", gfind_nodef},
-  {"gmatch", gmatch},
-  {"gsub", str_gsub},
   {"len", str_len},
   {"lower", str_lower},
-  {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
   {"sub", str_sub},
@@ -889,6 +1519,36 @@ static const luaL_Reg strlib[] = {
 };
 
 
+/* functions sharing the cache of compiled patterns */
+static const luaL_Reg patlib[] = {
+  {"find", str_find},
+  {"gmatch", gmatch},
+  {"gsub", str_gsub},
+  {"match", str_match},
+  {NULL, NULL}
+};
+
+
+static void createpatterns (lua_State *L) {
+  const luaL_Reg *l;
+  PatCache *c;
+  luaL_newmetatable(L, PATTERNHANDLE);  /* metatable for compiled patterns */
+  lua_pushcfunction(L, pattern_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pop(L, 1);
+  c = (PatCache *)lua_newuserdata(L, sizeof(PatCache));
+  memset(c, 0, sizeof(PatCache));
+  lua_createtable(L, 2*LUA_PATTERNCACHE + 1, 0);  /* keys and programs */
+  lua_setfenv(L, -2);
+  for (l = patlib; l->name != NULL; l++) {
+    lua_pushvalue(L, -1);
+    lua_pushcclosure(L, l->func, 1);
+    lua_setfield(L, -3, l->name);
+  }
+  lua_pop(L, 1);  /* cache */
+}
+
+
 static void createmetatable (lua_State *L) {
   lua_createtable(L, 0, 1);  /* create metatable for strings */
   lua_pushliteral(L, "");  /* dummy string */
@@ -906,6 +1566,7 @@ static void createmetatable (lua_State *L) {
 */
 LUALIB_API int luaopen_string (lua_State *L) {
   luaL_register(L, LUA_STRLIBNAME, strlib);
+  createpatterns(L);
 #if defined(LUA_COMPAT_GFIND)
   lua_getfield(L, -1, "gmatch");
   lua_setfield(L, -2, "gfind");
@@ -12,11 +12,15 @@
 ** Non-negative integer keys are all candidates to be kept in the array
 ** part. The actual size of the array is the largest `n' such that at
 ** least half the slots between 0 and n are in use.
-** Hash uses a mix of chained scatter table with Brent's variation.
-** A main invariant of these tables is that, if an element is not
-** in its main position (i.e. the `original' position that its hash gives
-** to it), then the colliding element is in its own main position.
-** Hence even when the load factor reaches 100%, performance remains good.
+** Hash uses open addressing. Each node has a control byte, kept after
+** the node array in the same block: CTRLEMPTY for a free node, or seven
+** bits of the key's hash for a used one. A probe reads a whole group of
+** control bytes at once and only compares the keys whose byte matches.
+** Keys are never removed (a key whose value is nil keeps its node until
+** the next rehash), so there are no tombstones and a probe stops at the
+** first group with a free node. The table keeps a free node in every
+** group-sized window by rehashing at 7/8 of its size; a hash part that
+** fits in one group may fill completely, as its probe covers all nodes.
 */
 
 #include <math.h>
@@ -33,6 +37,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "ltable.h"
 
 
@@ -48,21 +53,80 @@
 #define MAXASIZE	(1 << MAXBITS)
 
 
-#define hashpow2(t,n)      (gnode(t, lmod((n), sizenode(t))))
-  
-#define hashstr(t,str)  hashpow2(t, (str)->tsv.hash)
-#define hashboolean(t,p)        hashpow2(t, p)
+/*
+** control bytes are handled a group at a time, as the bytes of a word
+*/
+typedef size_t Group;
+
+#define GROUPSIZE	cast_int(sizeof(Group))
+
+#define CTRLEMPTY	0x80
+
+#define LSBS		(~cast(Group, 0) / 0xff)  /* 0x0101...01 */
+#define MSBS		(LSBS << 7)  /* 0x8080...80 */
+
+/* control byte for a key with hash `h' */
+#define ctrlbyte(h)	cast(unsigned char, ((h) >> 25) & 0x7f)
+
+/* the last GROUPSIZE-1 bytes repeat the first ones (see `setctrl') */
+#define getctrl(t)	cast(unsigned char *, (t)->node + sizenode(t))
+
+/* size of the block with a hash part of `size' nodes */
+#define hashbytes(size)	((size)*(sizeof(Node) + 1) + GROUPSIZE - 1)
+
+/* number of nodes that may be used before a rehash */
+#define maxfill(size)	((size) <= GROUPSIZE ? (size) : (size) - (size)/8)
+
+
+static Group loadgroup (const unsigned char *c) {
+  Group g;
+  memcpy(&g, c, sizeof(Group));
+  return g;
+}
 
 
 /*
-** for some types, it is better to avoid modulus by power of 2, as
-** they tend to have many 2 factors.
+** returns a group with the high bit set in the bytes equal to `b' (and
+** maybe in a few others, so candidates must still be checked)
 */
-// 对某些类型而言,最好避免直接与2的次幂模操作取hash值,因为它们可能有很多2因子
-#define hashmod(t,n)	(gnode(t, ((n) % ((sizenode(t)-1)|1))))
+static Group matchbyte (Group g, int b) {
+  Group x = g ^ (LSBS * cast(Group, b));
+  return (x - LSBS) & ~x & MSBS;
+}
+
+#define matchempty(g)	((g) & MSBS)
+
+
+/*
+** `firstmatch' gives the index of the first byte marked in a (non-zero)
+** match and `nextmatch' unmarks it
+*/
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+#define firstmatch(m)	cast_int(__builtin_ctzll(m) >> 3)
+#define nextmatch(m)	((m) & ((m) - 1))
+
+#else
+
+static int firstmatch (Group m) {
+  unsigned char b[sizeof(Group)];
+  int i = 0;
+  memcpy(b, &m, sizeof(Group));
+  while (!(b[i] & 0x80)) i++;
+  return i;
+}
 
 
-#define hashpointer(t,p)	hashmod(t, IntPoint(p))
+static Group nextmatch (Group m) {
+  unsigned char b[sizeof(Group)];
+  memcpy(b, &m, sizeof(Group));
+  b[firstmatch(m)] = 0;
+  memcpy(&m, b, sizeof(Group));
+  return m;
+}
+
+#endif
 
 
 /*
@@ -72,51 +136,216 @@
 
 
 
-#define dummynode		(&dummynode_)
+#define dummynode		(&dummy_.n)
 
-static const Node dummynode_ = {
-  {{NULL}, LUA_TNIL},  /* value */
-  {{{NULL}, LUA_TNIL, NULL}}  /* key */
+static const struct {
+  Node n;
+  unsigned char ctrl[16];  /* at least GROUPSIZE bytes */
+} dummy_ = {
+  {{{NULL}, LUA_TNIL},  /* value */
+   {{{NULL}, LUA_TNIL}}},  /* key */
+  {CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY}
 };
 
 
 /*
 ** hash for lua_Numbers
 */
-// 对数字进行hash
-static Node *hashnum (const Table *t, lua_Number n) {
+static unsigned int hashnum (lua_Number n) {
   unsigned int a[numints];
   int i;
   if (luai_numeq(n, 0))  /* avoid problems with -0 */
-    return gnode(t, 0); // &t->node[0]
+    return 0;
   memcpy(a, &n, sizeof(a));
   for (i = 1; i < numints; i++) a[0] += a[i];
-  return hashmod(t, a[0]);
+  return a[0];
 }
 
 
-
 /*
-** returns the `main' position of an element in a table (that is, the index
-** of its hash value)
+** spread the bits of a raw hash: pointers and numbers have many
+** constant low bits, and the control byte comes from the high ones
 */
-// 根据key寻找在hash中的Node
-static Node *mainposition (const Table *t, const TValue *key) {
+static unsigned int mixhash (unsigned int h) {
+  h *= 0x9e3779b1u;
+  return h ^ (h >> 15);
+}
+
+
+static unsigned int hashkey (const TValue *key) {
   switch (ttype(key)) {
     case LUA_TNUMBER:
-      return hashnum(t, nvalue(key));
+      return mixhash(hashnum(nvalue(key)));
     case LUA_TSTRING:
-      return hashstr(t, rawtsvalue(key));
+      return mixhash(luaS_hash(rawtsvalue(key)));
     case LUA_TBOOLEAN:
-      return hashboolean(t, bvalue(key));
+      return mixhash(bvalue(key));
     case LUA_TLIGHTUSERDATA:
-      return hashpointer(t, pvalue(key));
+      return mixhash(IntPoint(pvalue(key)));
     default:
-      return hashpointer(t, gcvalue(key));
+      return mixhash(IntPoint(gcvalue(key)));
+  }
+}
+
+
+/*
+** Probing visits groups starting at the node given by the hash, with
+** triangular steps (GROUPSIZE, 2*GROUPSIZE, ...). As the size is a power
+** of 2, the groups visited before the step reaches the size cover every
+** node exactly once.
+*/
+#define firstpos(t,h)	cast_int((h) & (sizenode(t) - 1))
+#define nextpos(t,pos,step)	(((pos) + (step)) & (sizenode(t) - 1))
+
+
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+#define sizeshape(n)	(sizeof(Shape) + ((n) - 1) * sizeof(TString *))
+
+
+void luaH_initshapes (lua_State *L) {
+  global_State *g = G(L);
+  g->shaperoot.next = NULL;
+  g->shaperoot.parent = NULL;
+  g->shaperoot.child = NULL;
+  g->shaperoot.sibling = NULL;
+  g->shaperoot.nslots = 0;
+  g->shaperoot.marked = 0;
+  g->shaperoot.keybits = 0;
+  g->nshapes = 0;
+  memset(g->fieldcache, 0, sizeof(g->fieldcache));
+}
+
+
+/*
+** frees the shapes not used by any table since the last sweep, keeping
+** the ancestors of the used ones. Tables mark their shapes when they are
+** traversed and when they move to them, so the collector calls this when
+** marking is complete. Children come before their parents in the list,
+** so a shape is reached only after all its descendants.
+*/
+void luaH_sweepshapes (lua_State *L) {
+  global_State *g = G(L);
+  Shape **p = &g->shaperoot.next;
+  Shape *s;
+  int freed = 0;
+  while ((s = *p) != NULL) {
+    if (s->marked) {  /* used, or on the way to a used shape? */
+      s->marked = 0;
+      s->parent->marked = 1;  /* keep its parent */
+      p = &s->next;
+    }
+    else {  /* no table can reach it: free it */
+      Shape **q = &s->parent->child;
+      while (*q != s)
+        q = &(*q)->sibling;
+      *q = s->sibling;
+      *p = s->next;
+      luaM_freemem(L, s, sizeshape(s->nslots));
+      g->nshapes--;
+      freed = 1;
+    }
+  }
+  if (freed)  /* forget the slots cached for freed shapes */
+    memset(g->fieldcache, 0, sizeof(g->fieldcache));
+}
+
+
+void luaH_freeshapes (lua_State *L) {
+  global_State *g = G(L);
+  Shape *s = g->shaperoot.next;
+  while (s != NULL) {
+    Shape *next = s->next;
+    luaM_freemem(L, s, sizeshape(s->nslots));
+    s = next;
+  }
+  g->shaperoot.next = NULL;
+  g->nshapes = 0;
+}
+
+
+#define keybit(key)	(1u << ((key)->tsv.hash & 31))
+
+
+static int shapeslot (const Shape *s, const TString *key) {
+  int i;
+  if (!(s->keybits & keybit(key)))
+    return -1;  /* surely not there */
+  for (i = 0; i < s->nslots; i++)
+    if (s->keys[i] == key) return i;
+  return -1;
+}
+
+
+static void setslotvector (lua_State *L, Table *t, int size) {
+  int i;
+  G(L)->alloctt = LUA_TTABLE;
+  luaM_reallocvector(L, t->slots, t->sizeslots, size, TValue);
+  for (i = t->sizeslots; i < size; i++)
+    setnilvalue(&t->slots[i]);
+  t->sizeslots = cast_byte(size);
+}
+
+
+static Shape *findchild (Shape *s, TString *key) {
+  Shape *c;
+  for (c = s->child; c != NULL; c = c->sibling) {
+    if (c->keys[s->nslots] == key)
+      break;
   }
+  return c;
 }
 
 
+/*
+** moves `t' to the shape with one more key, `key', and returns the slot
+** of that key; returns NULL if the shape cannot grow
+*/
+static TValue *addslot (lua_State *L, Table *t, TString *key) {
+  global_State *g = G(L);
+  Shape *s = t->shape;
+  Shape *c = findchild(s, key);
+  int n = s->nslots;
+  if (n == LUAI_MAXSHAPESLOTS || (c == NULL && g->nshapes == LUAI_MAXSHAPES))
+    return NULL;
+  if (n == t->sizeslots) {  /* no room for another slot? */
+    int size = (n < 2) ? 4 : 2*n;
+    setslotvector(L, t, (size < LUAI_MAXSHAPESLOTS) ? size :
+                                                     LUAI_MAXSHAPESLOTS);
+    c = findchild(s, key);  /* a collection may have freed it */
+  }
+  if (c == NULL) {  /* no live table took this transition? */
+    c = cast(Shape *, luaM_malloc(L, sizeshape(n + 1)));
+    memcpy(c->keys, s->keys, n * sizeof(TString *));
+    c->keys[n] = key;
+    c->nslots = n + 1;
+    c->keybits = s->keybits | keybit(key);
+    c->parent = s;
+    c->child = NULL;
+    c->sibling = s->child;
+    s->child = c;
+    c->next = g->shaperoot.next;
+    g->shaperoot.next = c;
+    g->nshapes++;
+  }
+  c->marked = 1;  /* `t' may have been traversed already */
+  t->shape = c;
+  return &t->slots[n];
+}
+
+
+/*
+** }=============================================================
+*/
+
+
 /*
 ** returns the index for `key' if `key' is an appropriate key to live in
 ** the array part of the table, -1 otherwise.
@@ -136,7 +365,7 @@ static int arrayindex (const TValue *key) {
 
 /*
 ** returns the index of a `key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
+** elements in the array part, then the slots, then the hash part. The
 ** beginning of a traversal is signalled by -1.
 */
 // 根据key寻找索引(无论是在数字还是hash中)
@@ -149,23 +378,36 @@ static int findindex (lua_State *L, Table *t, StkId key) {
   if (0 < i && i <= t->sizearray)  /* is `key' inside array part? */
 	// 返回的index需要-1是因为要跟C数组匹配上
     return i-1;  /* yes; that's the index (corrected to C) */
+  else if (ttisstring(key) &&
+           (i = shapeslot(t->shape, rawtsvalue(key))) >= 0)
+    return t->sizearray + i;  /* slots are numbered after the array */
   else {
 	// 否则查找hash部分
-    Node *n = mainposition(t, key);
-    do {  /* check whether `key' is somewhere in the chain */
-      /* key may be dead already, but it is ok to use it in `next' */
-      if (luaO_rawequalObj(key2tval(n), key) ||
-            (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
-             gcvalue(gkey(n)) == gcvalue(key))) {
-    	// 需要算出在hash部分中的偏移位置
-        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        // 这个偏移位置还要加上数组部分的长度,以便区分
-        return i + t->sizearray;
+    const unsigned char *ctrl = getctrl(t);
+    unsigned int h = hashkey(key);
+    int c = ctrlbyte(h);
+    int pos = firstpos(t, h);
+    int step = 0;
+    Node *dead = NULL;
+    for (;;) {
+      Group g = loadgroup(ctrl + pos);
+      Group m;
+      for (m = matchbyte(g, c); m != 0; m = nextmatch(m)) {
+        Node *n = gnode(t, nextpos(t, pos, firstmatch(m)));
+        if (luaO_rawequalObj(key2tval(n), key))
+          return cast_int(n - gnode(t, 0)) + t->sizearray + t->shape->nslots;
+        /* key may be dead already, but it is ok to use it in `next';
+           a live entry wins, as a new object may reuse a dead address */
+        if (dead == NULL && ttype(gkey(n)) == LUA_TDEADKEY &&
+            iscollectable(key) && gcvalue(gkey(n)) == gcvalue(key))
+          dead = n;
       }
-      // 没有找到的话,就继续寻找hash桶中的下一个元素
-      else n = gnext(n);
-    } while (n);
+      step += GROUPSIZE;
+      if (matchempty(g) || step >= sizenode(t)) break;
+      pos = nextpos(t, pos, step);
+    }
+    if (dead != NULL)
+      return cast_int(dead - gnode(t, 0)) + t->sizearray + t->shape->nslots;
     luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* key not found */
     return 0;  /* to avoid warnings */
   }
@@ -183,10 +425,17 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       return 1;
     }
   }
+  for (i -= t->sizearray; i < t->shape->nslots; i++) {  /* then slots */
+    if (!ttisnil(&t->slots[i])) {
+      setsvalue2s(L, key, t->shape->keys[i]);
+      setobj2s(L, key+1, &t->slots[i]);
+      return 1;
+    }
+  }
   // 需要减去数组部分长度,
   // 这里居然使用的i++,不是node中的next,这不对吧????
   // 换言之,这里取到的不是在同一个hash桶上的node
-  for (i -= t->sizearray; i < sizenode(t); i++) {  /* then hash part */
+  for (i -= t->shape->nslots; i < sizenode(t); i++) {  /* then hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, key2tval(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
@@ -290,6 +539,7 @@ static int numusehash (const Table *t, int *nums, int *pnasize) {
 static void setarrayvector (lua_State *L, Table *t, int size) {
   int i;
   // 为什么这里用的是luaM_reallocvector,而后面的setnodevector中使用的是luaM_newvector
+  G(L)->alloctt = LUA_TTABLE;  /* account the parts to the table */
   luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
   for (i=t->sizearray; i<size; i++)
      setnilvalue(&t->array[i]);
@@ -302,11 +552,14 @@ static void setnodevector (lua_State *L, Table *t, int size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common `dummynode' */
     lsize = 0;
+    t->hfree = 0;  /* first insertion must rehash */
   }
   else {
     int i;
     // 为什么这里要计算log2,因为lsizenode就是log2值
     lsize = ceillog2(size);
+    if (maxfill(twoto(lsize)) < size)  /* must keep some nodes free? */
+      lsize++;
     // 过大了!!
     if (lsize > MAXBITS)
       luaG_runerror(L, "table overflow");
@@ -314,21 +567,23 @@ static void setnodevector (lua_State *L, Table *t, int size) {
     size = twoto(lsize);
     // 以上的ceillog2和twoto操作将size转换为大于size且为2的次幂的最小的数
     // 见setarrayvector中注释
-    t->node = luaM_newvector(L, size, Node);
+    G(L)->alloctt = LUA_TTABLE;
+    t->node = cast(Node *, luaM_malloc(L, hashbytes(size)));
     // 初始化每个hash成员
     for (i=0; i<size; i++) {
       Node *n = gnode(t, i);
-      // 将next指针置NULL,将key/value置NIL
-      gnext(n) = NULL;
       setnilvalue(gkey(n));
       setnilvalue(gval(n));
     }
+    memset(t->node + size, CTRLEMPTY, size + GROUPSIZE - 1);
+    t->hfree = maxfill(size);
   }
-  // 存放尺寸和lastfree指针指向最后一个元素
   t->lsizenode = cast_byte(lsize);
-  t->lastfree = gnode(t, size);  /* all positions are free */
 }
 
+static TValue *newhashkey (lua_State *L, Table *t, const TValue *key);
+
+
 // 重新分配table的数组和hash部分的大小
 static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
   int i;
@@ -347,9 +602,12 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
     // 遍历多出来的那部分
     for (i=nasize; i<oldasize; i++) {
       // 如果多出来的部分元素不为nil
-      if (!ttisnil(&t->array[i]))
+      if (!ttisnil(&t->array[i])) {
+        TValue k;  /* (not `luaH_setnum': the array part must not grow) */
+        setnvalue(&k, cast_num(i+1));
     	// 以i + 1为key, 将i的数据插入hash部分
-        setobjt2t(L, luaH_setnum(L, t, i+1), &t->array[i]);
+        setobjt2t(L, newhashkey(L, t, &k), &t->array[i]);
+      }
     }
     /* shrink array */
     // 缩减数组大小
@@ -360,18 +618,24 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
   for (i = twoto(oldhsize) - 1; i >= 0; i--) {
     Node *old = nold+i;
     // 将原来不为nil的元素重新插入hash中
-    if (!ttisnil(gval(old)))
-      setobjt2t(L, luaH_set(L, t, key2tval(old)), gval(old));
+    if (!ttisnil(gval(old))) {
+      /* (not `luaH_set': the array part must not grow, and nothing may be
+         allocated while the entries are only in `nold': no new slots) */
+      TValue *v = cast(TValue *, luaH_get(t, key2tval(old)));
+      if (v == luaO_nilobject)
+        v = newhashkey(L, t, key2tval(old));
+      setobjt2t(L, v, gval(old));
+    }
   }
   // 释放旧的hash部分
   if (nold != dummynode)
-    luaM_freearray(L, nold, twoto(oldhsize), Node);  /* free old array */
+    luaM_freemem(L, nold, hashbytes(twoto(oldhsize)));  /* free old array */
 }
 
 // 数组部分重新分配
 void luaH_resizearray (lua_State *L, Table *t, int nasize) {
-  int nsize = (t->node == dummynode) ? 0 : sizenode(t);
-  resize(L, t, nasize, nsize);
+  int nsize = (t->node == dummynode) ? 0 : maxfill(sizenode(t));
+  resize(L, t, nasize, nsize);  /* keep the same node vector size */
 }
 
 /*
@@ -414,9 +678,23 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
 ** }=============================================================
 */
 
+
+
+/*
+** memory used by table `t'
+*/
+size_t luaH_bytes (const Table *t) {
+  size_t size = sizeof(Table) + sizeof(TValue) * t->sizearray +
+                                sizeof(TValue) * t->sizeslots;
+  if (t->node != dummynode)
+    size += hashbytes(sizenode(t));
+  return size;
+}
+
+
 // 新分配table
 Table *luaH_new (lua_State *L, int narray, int nhash) {
-  Table *t = luaM_new(L, Table);
+  Table *t = cast(Table *, luaM_newobject(L, LUA_TTABLE, sizeof(Table)));
   luaC_link(L, obj2gco(t), LUA_TTABLE);
   t->metatable = NULL;
   t->flags = cast_byte(~0);
@@ -425,74 +703,196 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
   t->sizearray = 0;
   t->lsizenode = 0;
   t->node = cast(Node *, dummynode);
+  t->hfree = 0;
+  t->border = 0;
+  t->shape = &G(L)->shaperoot;
+  t->slots = NULL;
+  t->sizeslots = 0;
   setarrayvector(L, t, narray);
-  setnodevector(L, t, nhash);
+  if (0 < nhash && nhash <= LUAI_MAXSHAPESLOTS &&  /* probably a record */
+      G(L)->nshapes < LUAI_MAXSHAPES)  /* that can get a shape? */
+    setslotvector(L, t, nhash);
+  else
+    setnodevector(L, t, nhash);
   return t;
 }
 
 // 释放table
 void luaH_free (lua_State *L, Table *t) {
   if (t->node != dummynode)
-    luaM_freearray(L, t->node, sizenode(t), Node);
+    luaM_freemem(L, t->node, hashbytes(sizenode(t)));
   luaM_freearray(L, t->array, t->sizearray, TValue);
+  luaM_freearray(L, t->slots, t->sizeslots, TValue);
   luaM_free(L, t);
 }
 
-// 在hash中寻找一个可用位置
-static Node *getfreepos (Table *t) {
-  while (t->lastfree-- > t->node) {
-    if (ttisnil(gkey(t->lastfree)))
-      return t->lastfree;
+
+/*
+** remove all entries of a table but keep its parts for reuse
+*/
+void luaH_clear (Table *t) {
+  int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  for (i = 0; i < t->shape->nslots; i++)  /* keep the shape for reuse */
+    setnilvalue(&t->slots[i]);
+  if (t->node != dummynode) {
+    for (i = 0; i < sizenode(t); i++) {
+      Node *n = gnode(t, i);
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    memset(getctrl(t), CTRLEMPTY, sizenode(t) + GROUPSIZE - 1);
+    t->hfree = maxfill(sizenode(t));
   }
-  return NULL;  /* could not find a free place */
+  t->flags = 0;  /* the table may be a metatable: forget cached absences */
 }
 
+/*
+** set the control byte of node `i' and of its copies at the end
+*/
+static void setctrl (Table *t, int i, int c) {
+  unsigned char *ctrl = getctrl(t);
+  int size = sizenode(t);
+  ctrl[i] = cast(unsigned char, c);
+  for (i += size; i < size + GROUPSIZE - 1; i += size)
+    ctrl[i] = cast(unsigned char, c);
+}
 
 
 /*
-** inserts a new key into a hash table; first, check whether key's main 
-** position is free. If not, check whether colliding node is in its main 
-** position or not: if it is not, move colliding node to an empty place and 
-** put new key in its main position; otherwise (colliding node is in its main 
-** position), new key goes to an empty position. 
-** 1、根据key来查找其所在散列桶的 mainposition ，如果返回的结果中，该Node的值为nil，直接将key赋值并返回Node的TValue指针就可以了
-** 2、否则说明该 mainposition 上已经有其他数据了，需要重新分配空间给这个新的key，然后将这个新的Node串联到对应的散列桶上
+** returns the first free node in the probe sequence of hash `h'
 */
-// 向hash中插入一个新的key
-static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
-  // 根据key寻找在hash中的位置
-  Node *mp = mainposition(t, key);
-  // 如果该位置上已经有数据了(!ttisnil(gval(mp)), 或者找不到位置(mp == dummynode)
-  if (!ttisnil(gval(mp)) || mp == dummynode) {
-    Node *othern;
-    // 尝试着获取一个空闲位置
-    Node *n = getfreepos(t);  /* get a free place */
-    // 找不到空闲位置?
-    if (n == NULL) {  /* cannot find a free place? */
-      rehash(L, t, key);  /* grow table */
-      return luaH_set(L, t, key);  /* re-insert key into grown table */
+static int getfreepos (Table *t, unsigned int h) {
+  const unsigned char *ctrl = getctrl(t);
+  int pos = firstpos(t, h);
+  int step = 0;
+  for (;;) {
+    Group m = matchempty(loadgroup(ctrl + pos));
+    if (m != 0)
+      return nextpos(t, pos, firstmatch(m));
+    step += GROUPSIZE;
+    lua_assert(step < sizenode(t));  /* `hfree' keeps some node free */
+    pos = nextpos(t, pos, step);
+  }
+}
+
+
+
+/*
+** search function for integer keys in the hash part
+*/
+static const TValue *hashgetnum (Table *t, int key) {
+  lua_Number nk = cast_num(key);
+  const unsigned char *ctrl = getctrl(t);
+  unsigned int h = mixhash(hashnum(nk));
+  int c = ctrlbyte(h);
+  int pos = firstpos(t, h);
+  int step = 0;
+  for (;;) {
+    Group g = loadgroup(ctrl + pos);
+    Group m;
+    for (m = matchbyte(g, c); m != 0; m = nextmatch(m)) {
+      Node *n = gnode(t, nextpos(t, pos, firstmatch(m)));
+      if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
+        return gval(n);  /* that's it */
     }
-    lua_assert(n != dummynode);
-    othern = mainposition(t, key2tval(mp));
-    if (othern != mp) {  /* is colliding node out of its main position? */
-      /* yes; move colliding node into free position */
-      while (gnext(othern) != mp) othern = gnext(othern);  /* find previous */
-      gnext(othern) = n;  /* redo the chain with `n' in place of `mp' */
-      *n = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
-      gnext(mp) = NULL;  /* now `mp' is free */
-      setnilvalue(gval(mp));
+    step += GROUPSIZE;
+    if (matchempty(g) || step >= sizenode(t))
+      return luaO_nilobject;
+    pos = nextpos(t, pos, step);
+  }
+}
+
+
+/*
+** key `sizearray+1' of a table whose array part ends with a value: the
+** array part doubles without counting all keys again (see `rehash'),
+** and keys of the new range that were in the hash part move to it. It
+** keeps doubling while the hash part holds the next key and the last
+** range was at least half full, so data loaded from the end or with
+** holes reaches the array part at once. The hash part shrinks if most
+** of its keys moved.
+*/
+#define canappend(t) \
+  ((t)->sizearray < MAXASIZE/2 && \
+   ((t)->sizearray == 0 || !ttisnil(&(t)->array[(t)->sizearray - 1])))
+
+static TValue *appendkey (lua_State *L, Table *t) {
+  int key = t->sizearray + 1;
+  int oldasize = t->sizearray;
+  int nused = 1;  /* keys in the new range (counting `key') */
+  int nmoved = 0;
+  int i = key + 1;
+  for (;;) {
+    setarrayvector(L, t, (oldasize == 0) ? 1 : 2*oldasize);
+    if (t->node == dummynode) break;  /* nothing to move */
+    for (; i <= t->sizearray; i++) {
+      const TValue *v = hashgetnum(t, i);
+      if (!ttisnil(v)) {
+        setobjt2t(L, &t->array[i-1], v);
+        setnilvalue(cast(TValue *, v));  /* leave a removed node */
+        nused++;
+        nmoved++;
+      }
     }
-    else {  /* colliding node is in its own main position */
-      /* new node will go into free position */
-      gnext(n) = gnext(mp);  /* chain new position */
-      gnext(mp) = n;
-      mp = n;
+    if (2*nused < t->sizearray - oldasize || t->sizearray >= MAXASIZE/2 ||
+        ttisnil(hashgetnum(t, i)))
+      break;
+    oldasize = t->sizearray;
+    nused = 0;
+  }
+  if (nmoved > sizenode(t)/4) {  /* many removed nodes? */
+    int nhsize = 0;
+    for (i = 0; i < sizenode(t); i++)
+      if (!ttisnil(gval(gnode(t, i)))) nhsize++;
+    resize(L, t, t->sizearray, nhsize);  /* rebuild the hash part */
+  }
+  return &t->array[key-1];
+}
+
+
+/*
+** inserts a new key into the hash part. Check whether key's main
+** position holds a key whose value was removed: if so, that node is
+** reused. Otherwise, the key goes to the first free node of its probe
+** sequence, or the table grows if it cannot take one more key (so it
+** allocates nothing when the hash part was sized for the key).
+*/
+static TValue *newhashkey (lua_State *L, Table *t, const TValue *key) {
+  unsigned int h;
+  int i;
+  Node *n;
+  h = hashkey(key);
+  i = firstpos(t, h);
+  n = gnode(t, i);
+  if (getctrl(t)[i] == CTRLEMPTY || !ttisnil(gval(n))) {
+    if (t->hfree == 0) {  /* cannot take a new node? */
+      rehash(L, t, key);  /* grow table */
+      return luaH_set(L, t, key);  /* re-insert key into grown table */
     }
+    i = getfreepos(t, h);
+    n = gnode(t, i);
+    t->hfree--;
   }
-  gkey(mp)->value = key->value; gkey(mp)->tt = key->tt;
+  setctrl(t, i, ctrlbyte(h));
+  gkey(n)->value = key->value; gkey(n)->tt = key->tt;
   luaC_barriert(L, t, key);
-  lua_assert(ttisnil(gval(mp)));
-  return gval(mp);
+  lua_assert(ttisnil(gval(n)));
+  return gval(n);
+}
+
+
+/*
+** inserts a new key into a table; a string key goes to a new slot while
+** the table's shape can grow, other keys to the hash part
+*/
+static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
+  if (ttisstring(key) && isshortstr(rawtsvalue(key))) {  /* try a slot */
+    TValue *v = addslot(L, t, rawtsvalue(key));
+    if (v != NULL) return v;
+  }
+  return newhashkey(L, t, key);
 }
 
 
@@ -505,17 +905,8 @@ const TValue *luaH_getnum (Table *t, int key) {
   // 只要比sizearray小,那么都在数组部分
   if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
     return &t->array[key-1];
-  else {
-	// 否则在hash部分中
-    lua_Number nk = cast_num(key);
-    Node *n = hashnum(t, nk);
-    do {  /* check whether `key' is somewhere in the chain */
-      if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
-        return gval(n);  /* that's it */
-      else n = gnext(n);
-    } while (n);
-    return luaO_nilobject;
-  }
+  else  // 否则在hash部分中
+    return hashgetnum(t, key);
 }
 
 
@@ -523,14 +914,51 @@ const TValue *luaH_getnum (Table *t, int key) {
 ** search function for strings
 */
 // 以字符串为key的查找函数
+static const TValue *hashgetstr (Table *t, TString *key) {
+  const unsigned char *ctrl = getctrl(t);
+  unsigned int h = mixhash(luaS_hash(key));
+  int c = ctrlbyte(h);
+  int pos = firstpos(t, h);
+  int step = 0;
+  for (;;) {
+    Group g = loadgroup(ctrl + pos);
+    Group m;
+    for (m = matchbyte(g, c); m != 0; m = nextmatch(m)) {
+      Node *n = gnode(t, nextpos(t, pos, firstmatch(m)));
+      if (ttisstring(gkey(n)) && luaS_eqstr(rawtsvalue(gkey(n)), key))
+        return gval(n);  /* that's it */
+    }
+    step += GROUPSIZE;
+    if (matchempty(g) || step >= sizenode(t))
+      return luaO_nilobject;
+    pos = nextpos(t, pos, step);
+  }
+}
+
+
 const TValue *luaH_getstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
-  do {  /* check whether `key' is somewhere in the chain */
-    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
-      return gval(n);  /* that's it */
-    else n = gnext(n);
-  } while (n);
-  return luaO_nilobject;
+  int i = shapeslot(t->shape, key);
+  if (i >= 0)
+    return &t->slots[i];
+  return hashgetstr(t, key);
+}
+
+
+/*
+** search function for fields: the slot of `key' in tables with the
+** shape in `fc' is known without searching
+*/
+const TValue *luaH_getfield (Table *t, TString *key, FieldCache *fc) {
+  Shape *s = t->shape;
+  int i;
+  if (fc->shape == s && s->keys[fc->slot] == key)
+    return &t->slots[fc->slot];
+  i = shapeslot(s, key);
+  if (i < 0)
+    return hashgetstr(t, key);
+  fc->shape = s;
+  fc->slot = i;
+  return &t->slots[i];
 }
 
 
@@ -552,13 +980,24 @@ const TValue *luaH_get (Table *t, const TValue *key) {
       // 注意前面的不成功,再走近下面的hash部分
     }
     default: {
-      Node *n = mainposition(t, key);
-      do {  /* check whether `key' is somewhere in the chain */
-        if (luaO_rawequalObj(key2tval(n), key))
-          return gval(n);  /* that's it */
-        else n = gnext(n);
-      } while (n);
-      return luaO_nilobject;
+      const unsigned char *ctrl = getctrl(t);
+      unsigned int h = hashkey(key);
+      int c = ctrlbyte(h);
+      int pos = firstpos(t, h);
+      int step = 0;
+      for (;;) {
+        Group g = loadgroup(ctrl + pos);
+        Group m;
+        for (m = matchbyte(g, c); m != 0; m = nextmatch(m)) {
+          Node *n = gnode(t, nextpos(t, pos, firstmatch(m)));
+          if (luaO_rawequalObj(key2tval(n), key))
+            return gval(n);  /* that's it */
+        }
+        step += GROUPSIZE;
+        if (matchempty(g) || step >= sizenode(t))
+          return luaO_nilobject;
+        pos = nextpos(t, pos, step);
+      }
     }
   }
 }
@@ -572,8 +1011,12 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
     return cast(TValue *, p);
   else {
     if (ttisnil(key)) luaG_runerror(L, "table index is nil");
-    else if (ttisnumber(key) && luai_numisnan(nvalue(key)))
-      luaG_runerror(L, "table index is NaN");
+    else if (ttisnumber(key)) {
+      if (luai_numisnan(nvalue(key)))
+        luaG_runerror(L, "table index is NaN");
+      if (nvalue(key) == cast_num(t->sizearray + 1) && canappend(t))
+        return appendkey(L, t);
+    }
     // 否则分配一个以key为key的新值
     return newkey(L, t, key);
   }
@@ -585,6 +1028,8 @@ TValue *luaH_setnum (lua_State *L, Table *t, int key) {
   if (p != luaO_nilobject)
 	// 如果原来有数据, 直接返回了
     return cast(TValue *, p);
+  else if (key == t->sizearray + 1 && canappend(t))
+    return appendkey(L, t);
   else {
 	// 否则没有的话, 新创建一个出来
     TValue k;
@@ -630,12 +1075,13 @@ static int unbound_search (Table *t, unsigned int j) {
 }
 
 
-/*
-** Try to find a boundary in table `t'. A `boundary' is an integer index
-** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
-*/
-// 找到第一个"boundary"位置--它本身不为空, 而后一个元素为nil,
-int luaH_getn (Table *t) {
+static int isboundary (Table *t, int i) {
+  return (i == 0 || !ttisnil(luaH_getnum(t, i))) &&
+         ttisnil(luaH_getnum(t, i + 1));
+}
+
+
+static int findboundary (Table *t) {
   // 首先取数组的大小
   unsigned int j = t->sizearray;
   if (j > 0 && ttisnil(&t->array[j - 1])) {
@@ -656,11 +1102,32 @@ int luaH_getn (Table *t) {
 }
 
 
+/*
+** Try to find a boundary in table `t'. A `boundary' is an integer index
+** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+** The last boundary found is kept as a hint: it is checked before any
+** search, so writes need not update it, and appending to (or removing
+** from) the end of a sequence only moves it by one.
+*/
+// 找到第一个"boundary"位置--它本身不为空, 而后一个元素为nil,
+int luaH_getn (Table *t) {
+  int b = t->border;
+  if (isboundary(t, b))
+    return b;
+  else if (b < MAX_INT && isboundary(t, b + 1))
+    return t->border = b + 1;
+  else if (b > 0 && isboundary(t, b - 1))
+    return t->border = b - 1;
+  else
+    return t->border = findboundary(t);
+}
+
+
 
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
-  return mainposition(t, key);
+  return gnode(t, firstpos(t, hashkey(key)));
 }
 
 int luaH_isdummy (Node *n) { return n == dummynode; }
@@ -54,6 +54,23 @@ static int foreach (lua_State *L) {
 }
 
 
+static int tnew (lua_State *L) {
+  int narray = luaL_optint(L, 1, 0);
+  int nhash = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narray >= 0, 1, "negative size");
+  luaL_argcheck(L, nhash >= 0, 2, "negative size");
+  lua_createtable(L, narray, nhash);
+  return 1;
+}
+
+
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
 static int maxn (lua_State *L) {
   lua_Number max = 0;
   luaL_checktype(L, 1, LUA_TTABLE);
@@ -268,12 +285,14 @@ static int sort (lua_State *L) {
 
 
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
   {"concat", tconcat},
   {"foreach", foreach},
   {"foreachi", foreachi},
   {"getn", getn},
   {"maxn", maxn},
   {"insert", tinsert},
+  {"new", tnew},
   {"remove", tremove},
   {"setn", setn},
   {"sort", sort},
@@ -69,6 +69,11 @@ typedef int (*lua_Writer) (lua_State *L, const void* p, size_t sz, void* ud);
 */
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
+/*
+** prototype for functions that free all blocks of an allocator at once
+*/
+typedef void (*lua_FreeAll) (void *ud);
+
 
 /*
 ** basic types
@@ -114,6 +119,8 @@ typedef LUA_INTEGER lua_Integer;
 ** state manipulation
 */
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
+LUA_API lua_State *(lua_newstateseed) (lua_Alloc f, void *ud,
+                                       unsigned int seed);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
 
@@ -152,6 +159,8 @@ LUA_API int            (lua_lessthan) (lua_State *L, int idx1, int idx2);
 LUA_API lua_Number      (lua_tonumber) (lua_State *L, int idx);
 LUA_API lua_Integer     (lua_tointeger) (lua_State *L, int idx);
 LUA_API int             (lua_toboolean) (lua_State *L, int idx);
+/* may raise a memory error even for a string: a string built by
+   concatenation gets a buffer of its own ended by '\0' */
 LUA_API const char     *(lua_tolstring) (lua_State *L, int idx, size_t *len);
 LUA_API size_t          (lua_objlen) (lua_State *L, int idx);
 LUA_API lua_CFunction   (lua_tocfunction) (lua_State *L, int idx);
@@ -167,6 +176,8 @@ LUA_API void  (lua_pushnil) (lua_State *L);
 LUA_API void  (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void  (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API void  (lua_pushlstring) (lua_State *L, const char *s, size_t l);
+LUA_API const char *(lua_pushexternalstring) (lua_State *L, const char *s,
+                                size_t l, lua_Alloc falloc, void *ud);
 LUA_API void  (lua_pushstring) (lua_State *L, const char *s);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
@@ -199,6 +210,7 @@ LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, int n);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API int   (lua_setfenv) (lua_State *L, int idx);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
 
 
 /*
@@ -211,6 +223,7 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                                         const char *chunkname);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
+LUA_API int (lua_heapsnapshot) (lua_State *L, lua_Writer writer, void *data);
 
 
 /*
@@ -234,10 +247,50 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCDEFERFINALIZERS	8
+#define LUA_GCRUNFINALIZERS	9
+#define LUA_GCSETLIMIT		10
+#define LUA_GCLIMIT		11
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** garbage-collection statistics
+*/
+
+/* phases of a collection cycle */
+#define LUA_GCPPROPAGATE	0
+#define LUA_GCPATOMIC		1
+#define LUA_GCPSWEEPSTRING	2
+#define LUA_GCPSWEEP		3
+#define LUA_GCPFINALIZE		4
+#define LUA_GCNPHASES		5
+
+/* buckets of the step-duration histogram (powers of 2 in microseconds) */
+#define LUA_GCNBUCKETS		16
+
+/* collectable type tags, including internal prototypes and upvalues */
+#define LUA_GCNTYPES		11
+
+typedef struct lua_GCStats {
+  unsigned long cycles;  /* number of completed collection cycles */
+  unsigned long steps;  /* number of incremental steps */
+  double phasetime[LUA_GCNPHASES];  /* seconds spent in each phase */
+  double steptime;  /* seconds spent in all incremental steps */
+  double stepmax;  /* duration of the longest incremental step */
+  /* stephist[0] counts steps under 1us, stephist[i] those under 2^i us
+     and the last bucket all the longer ones */
+  unsigned long stephist[LUA_GCNBUCKETS];
+  size_t lastfreed;  /* bytes freed by the last complete cycle */
+  size_t totalfreed;  /* bytes freed since the state was created */
+  /* live objects per type tag, as seen by the last sweep */
+  unsigned long census[LUA_GCNTYPES];
+} lua_GCStats;
+
+LUA_API void (lua_getgcstats) (lua_State *L, lua_GCStats *s);
+
+
 /*
 ** miscellaneous functions
 */
@@ -250,6 +303,7 @@ LUA_API void  (lua_concat) (lua_State *L, int n);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void (lua_setfreeall) (lua_State *L, lua_FreeAll f);
 
 
 
@@ -350,6 +404,9 @@ LUA_API lua_Hook lua_gethook (lua_State *L);
 LUA_API int lua_gethookmask (lua_State *L);
 LUA_API int lua_gethookcount (lua_State *L);
 
+LUA_API int lua_setallocprofile (lua_State *L, int rate);
+LUA_API int lua_dumpallocprofile (lua_State *L, lua_Writer writer, void *data);
+
 
 struct lua_Debug {
   int event;
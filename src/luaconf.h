@@ -56,6 +56,7 @@
 #define LUA_USE_ISATTY
 #define LUA_USE_POPEN
 #define LUA_USE_ULONGJMP
+#define LUA_USE_MMAP
 #endif
 
 
@@ -64,11 +65,14 @@
 @* Lua check to set its paths.
 @@ LUA_INIT is the name of the environment variable that Lua
 @* checks for initialization code.
+@@ LUA_HASHSEED is the name of the environment variable that fixes the
+@* seed of string hashes in states created by the auxiliary library.
 ** CHANGE them if you want different names.
 */
 #define LUA_PATH        "LUA_PATH"
 #define LUA_CPATH       "LUA_CPATH"
 #define LUA_INIT	"LUA_INIT"
+#define LUA_HASHSEED	"LUA_HASHSEED"
 
 
 /*
@@ -313,6 +317,26 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 
 
+/*
+@@ luai_gcclock stores in 't' a timestamp (in seconds, as a double) used
+@* by the collector statistics (see 'lua_getgcstats').
+** CHANGE it if you have a better clock. By default Lua uses the
+** monotonic clock when POSIX is available and 'clock' otherwise.
+*/
+#if defined(lgc_c) || defined(luaall_c)
+#include <time.h>
+
+#if defined(LUA_USE_POSIX)
+#define luai_gcclock(t)	{ struct timespec ts_; \
+	clock_gettime(CLOCK_MONOTONIC, &ts_); \
+	(t) = (double)ts_.tv_sec + (double)ts_.tv_nsec * 1e-9; }
+#else
+#define luai_gcclock(t)	{ (t) = (double)clock() / (double)CLOCKS_PER_SEC; }
+#endif
+
+#endif
+
+
 
 /*
 @@ LUA_COMPAT_GETN controls compatibility with old getn behavior.
@@ -446,6 +470,56 @@
 #define LUAI_MAXCSTACK	8000
 
 
+/*
+@@ LUAI_MAXALLOCDEPTH is the number of innermost calls recorded for each
+@* sample of an allocation profile (see 'lua_setallocprofile').
+*/
+#define LUAI_MAXALLOCDEPTH	32
+
+
+/*
+@@ LUAI_MAXSHAPESLOTS is the maximum number of string keys that a table
+@* keeps in its shape (the others go to its hash part).
+@@ LUAI_MAXSHAPES limits the number of live shapes of a state.
+** CHANGE them if your records have more fields or if your programs
+** build many different records. Shapes live while some table uses
+** them, and they keep their keys alive. (LUAI_MAXSHAPESLOTS must be
+** smaller than 256.)
+*/
+#define LUAI_MAXSHAPESLOTS	16
+#define LUAI_MAXSHAPES		1024
+
+
+/*
+@@ LUAI_MAXSHORTLEN is the maximum length of strings kept in the string
+@* table. Longer strings are not interned: creating one does not hash it,
+@* and they are compared by contents.
+** CHANGE it if your programs create many equal long strings (interning
+** shares them) or compare long strings often.
+*/
+#define LUAI_MAXSHORTLEN	40
+
+
+/*
+@@ LUAI_MINROPE is the length from which a concatenation result is a rope
+@* string, which later concatenations may extend in place.
+** CHANGE it to trade the spare space of rope buffers (and the copy made
+** when C code first reads a rope that shares its buffer) against copies
+** of the left operand. It must be greater than LUAI_MAXSHORTLEN.
+*/
+#define LUAI_MINROPE	256
+
+
+/*
+@@ LUAI_NUMCACHE is the number of entries (a power of 2) of the cache of
+@* strings of integers converted by `tostring' and concatenation.
+** CHANGE it to keep more (or fewer) such strings. An integer `i' goes
+** to entry `i' modulo LUAI_NUMCACHE, so the integers from 0 to
+** LUAI_NUMCACHE-1 never evict each other.
+*/
+#define LUAI_NUMCACHE	256
+
+
 
 /*
 ** {==================================================================
@@ -524,6 +598,23 @@
 #define LUAI_MAXNUMBER2STR	32 /* 16 digits, sign, point, and \0 */
 #define lua_str2number(s,p)	strtod((s), (p))
 
+/*
+@@ LUAI_FASTNUM2STR makes the core write numbers with its own formatter,
+@* which gives the text of "%.14g" (with a '.' whatever the locale)
+@* without calling sprintf for most values.
+** CHANGE it (undefine it) if you change LUA_NUMBER_FMT or LUA_NUMBER;
+** the core then uses lua_number2str for every number.
+*/
+#define LUAI_FASTNUM2STR
+
+/*
+@@ LUAI_FASTSTR2NUM makes the core read plain decimal numerals itself
+@* (with a '.' whatever the locale) when it can get the exact double,
+@* leaving other numerals to lua_str2number.
+** CHANGE it (undefine it) if you change LUA_NUMBER or lua_str2number.
+*/
+#define LUAI_FASTSTR2NUM
+
 
 /*
 @@ The luai_num* macros define the primitive operations over numbers.
@@ -634,6 +725,15 @@ union luai_Cast { double l_d; long l_l; };
 #define LUA_MAXCAPTURES		32
 
 
+/*
+@@ LUA_PATTERNCACHE is the number of patterns whose compiled programs
+@* are kept by the string library for `find', `match', `gmatch' and
+@* `gsub'.
+** CHANGE it if your programs use many different patterns in turn.
+*/
+#define LUA_PATTERNCACHE	32
+
+
 /*
 @@ lua_tmpnam is the function that the OS library uses to create a
 @* temporary name.
@@ -684,6 +784,45 @@ union luai_Cast { double l_d; long l_l; };
 
 #endif
 
+/*
+@@ LUAI_LARGEOBJECT is the block size from which the default allocator
+@* (see 'l_alloc' in lauxlib.c) maps memory directly from the system.
+@@ lua_largemap/lua_largeunmap map and unmap such blocks.
+@@ lua_largepagesize is the granularity of those mappings.
+** CHANGE them if your system has another way to map anonymous memory.
+** Large strings and userdata are then given back to the system as soon
+** as they are collected, instead of fragmenting the malloc heap. Leave
+** LUAI_LARGEOBJECT undefined to always use 'realloc'.
+*/
+#if defined(lauxlib_c) || defined(luaall_c)
+
+#if defined(LUA_USE_MMAP)
+#include <sys/mman.h>
+#include <unistd.h>
+#define LUAI_LARGEOBJECT	(256*1024)
+#define lua_largemap(n)	lua_largemapaux(mmap(NULL, (n), \
+	PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))
+#define lua_largemapaux(p)	((p) == MAP_FAILED ? NULL : (p))
+#define lua_largeunmap(p,n)	((void)munmap((p), (n)))
+#define lua_largepagesize	((size_t)sysconf(_SC_PAGESIZE))
+#endif
+
+#endif
+
+
+/*
+@@ LUAI_POOLMAX is the largest block served from size-class pools by
+@* 'luaL_newpoolstate' and 'luaL_newarenastate' (see lauxlib.c); larger
+@* blocks go to 'l_alloc'.
+@@ LUAI_POOLSLAB is the size of the slabs those pools are cut from.
+** CHANGE them to trade memory kept in free lists for allocation speed.
+** Leave LUAI_POOLMAX undefined to make 'luaL_newpoolstate' and
+** 'luaL_newarenastate' the same as 'luaL_newstate'.
+*/
+#define LUAI_POOLMAX	512
+#define LUAI_POOLSLAB	(16*1024)
+
+
 /*
 @@ LUA_DL_* define which dynamic-library system Lua should use.
 ** CHANGE here if Lua has problems choosing the appropriate
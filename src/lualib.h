@@ -14,6 +14,12 @@
 /* Key to file-handle type */
 #define LUA_FILEHANDLE		"FILE*"
 
+/* Key to typed-array type */
+#define LUA_ARRAYHANDLE		"ARRAY*"
+
+/* Key to string-buffer type */
+#define LUA_STRBUFHANDLE	"STRBUF*"
+
 
 #define LUA_COLIBNAME	"coroutine"
 LUALIB_API int (luaopen_base) (lua_State *L);
@@ -39,6 +45,13 @@ LUALIB_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUALIB_API int (luaopen_package) (lua_State *L);
 
+#define LUA_ARRAYLIBNAME	"array"
+LUALIB_API int (luaopen_array) (lua_State *L);
+
+#define LUA_STRBUFLIBNAME	"strbuf"
+LUALIB_API int (luaopen_strbuf) (lua_State *L);
+LUALIB_API const char *(strbuf_tolstring) (lua_State *L, int idx, size_t *len);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
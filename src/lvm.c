@@ -36,7 +36,7 @@
 const TValue *luaV_tonumber (const TValue *obj, TValue *n) {
   lua_Number num;
   if (ttisnumber(obj)) return obj;
-  if (ttisstring(obj) && luaO_str2d(svalue(obj), &num)) {
+  if (ttisstring(obj) && luaS_str2d(rawtsvalue(obj), &num)) {
     setnvalue(n, num);
     return n;
   }
@@ -51,8 +51,20 @@ int luaV_tostring (lua_State *L, StkId obj) {
   else {
     char s[LUAI_MAXNUMBER2STR];
     lua_Number n = nvalue(obj);
-    lua_number2str(s, n);
-    setsvalue2s(L, obj, luaS_new(L, s));
+    int i;
+    lua_number2int(i, n);
+    if (luai_numeq(cast_num(i), n) && (i != 0 || luai_numlt(0, 1/n))) {
+      /* an integer (but not -0): try the cache */
+      NumCache *c = &G(L)->numcache[lmod(i, LUAI_NUMCACHE)];
+      if (c->s == NULL || c->n != i) {  /* miss? */
+        TString *ts = luaS_newlstr(L, s, luaO_num2str(s, n));
+        c->n = i;
+        c->s = ts;
+      }
+      setsvalue2s(L, obj, c->s);
+    }
+    else
+      setsvalue2s(L, obj, luaS_newlstr(L, s, luaO_num2str(s, n)));
     return 1;
   }
 }
@@ -84,8 +96,8 @@ static void callTMres (lua_State *L, StkId res, const TValue *f,
   setobj2s(L, L->top, f);  /* push function */
   setobj2s(L, L->top+1, p1);  /* 1st argument */
   setobj2s(L, L->top+2, p2);  /* 2nd argument */
-  luaD_checkstack(L, 3);
-  L->top += 3;
+  L->top += 3;  /* (EXTRA_STACK has room for them) */
+  luaD_checkstack(L, 0);  /* may collect: the values must be below top */
   luaD_call(L, L->top - 3, 1);
   res = restorestack(L, result);
   L->top--;
@@ -100,8 +112,8 @@ static void callTM (lua_State *L, const TValue *f, const TValue *p1,
   setobj2s(L, L->top+1, p1);  /* 1st argument */
   setobj2s(L, L->top+2, p2);  /* 2nd argument */
   setobj2s(L, L->top+3, p3);  /* 3th argument */
-  luaD_checkstack(L, 4);
-  L->top += 4;
+  L->top += 4;  /* (EXTRA_STACK has room for them) */
+  luaD_checkstack(L, 0);  /* may collect: the values must be below top */
   luaD_call(L, L->top - 4, 0);
 }
 
@@ -205,10 +217,10 @@ static int call_orderTM (lua_State *L, const TValue *p1, const TValue *p2,
 }
 
 
-static int l_strcmp (const TString *ls, const TString *rs) {
-  const char *l = getstr(ls);
+static int l_strcmp (lua_State *L, TString *ls, TString *rs) {
+  const char *l = luaS_cstr(L, ls);
   size_t ll = ls->tsv.len;
-  const char *r = getstr(rs);
+  const char *r = luaS_cstr(L, rs);
   size_t lr = rs->tsv.len;
   for (;;) {
     int temp = strcoll(l, r);
@@ -234,7 +246,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   else if (ttisnumber(l))
     return luai_numlt(nvalue(l), nvalue(r));
   else if (ttisstring(l))
-    return l_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
+    return l_strcmp(L, rawtsvalue(l), rawtsvalue(r)) < 0;
   else if ((res = call_orderTM(L, l, r, TM_LT)) != -1)
     return res;
   return luaG_ordererror(L, l, r);
@@ -248,7 +260,7 @@ static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
   else if (ttisnumber(l))
     return luai_numle(nvalue(l), nvalue(r));
   else if (ttisstring(l))
-    return l_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
+    return l_strcmp(L, rawtsvalue(l), rawtsvalue(r)) <= 0;
   else if ((res = call_orderTM(L, l, r, TM_LE)) != -1)  /* first try `le' */
     return res;
   else if ((res = call_orderTM(L, r, l, TM_LT)) != -1)  /* else try `lt' */
@@ -276,6 +288,7 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
       tm = get_compTM(L, hvalue(t1)->metatable, hvalue(t2)->metatable, TM_EQ);
       break;  /* will try TM */
     }
+    case LUA_TSTRING: return luaS_eqstr(rawtsvalue(t1), rawtsvalue(t2));
     default: return gcvalue(t1) == gcvalue(t2);
   }
   if (tm == NULL) return 0;  /* no TM? */
@@ -304,14 +317,19 @@ void luaV_concat (lua_State *L, int total, int last) {
         if (l >= MAX_SIZET - tl) luaG_runerror(L, "string length overflow");
         tl += l;
       }
-      buffer = luaZ_openspace(L, &G(L)->buff, tl);
-      tl = 0;
-      for (i=n; i>0; i--) {  /* concat all strings */
-        size_t l = tsvalue(top-i)->len;
-        memcpy(buffer+tl, svalue(top-i), l);
-        tl += l;
+      if (tl >= LUAI_MINROPE) {  /* long result: build a rope string */
+        setsvalue2s(L, top-n, luaS_concat(L, top-n, n, tl));
+      }
+      else {
+        buffer = luaZ_openspace(L, &G(L)->buff, tl);
+        tl = 0;
+        for (i=n; i>0; i--) {  /* concat all strings */
+          size_t l = tsvalue(top-i)->len;
+          memcpy(buffer+tl, svalue(top-i), l);
+          tl += l;
+        }
+        setsvalue2s(L, top-n, luaS_newlstr(L, buffer, tl));
       }
-      setsvalue2s(L, top-n, luaS_newlstr(L, buffer, tl));
     }
     total -= n-1;  /* got `n' strings to create 1 new */
     last -= n-1;
@@ -366,6 +384,11 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 #define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
 
 
+/* field cache of the current instruction (see `luaH_getfield') */
+#define fieldcache(L,pc) \
+	(&G(L)->fieldcache[(IntPoint(pc) >> 2) & (FIELDCACHE - 1)])
+
+
 #define arith_op(op,tm) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
@@ -440,13 +463,29 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       case OP_GETGLOBAL: {
         TValue g;
         TValue *rb = KBx(i);
-        sethvalue(L, &g, cl->env);
+        const TValue *v;
         lua_assert(ttisstring(rb));
+        v = luaH_getfield(cl->env, rawtsvalue(rb), fieldcache(L, pc));
+        if (!ttisnil(v)) {
+          setobj2s(L, ra, v);
+          continue;
+        }
+        sethvalue(L, &g, cl->env);
         Protect(luaV_gettable(L, &g, rb, ra));
         continue;
       }
       case OP_GETTABLE: {
-        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
+        StkId rb = RB(i);
+        TValue *rc = RKC(i);
+        if (ttistable(rb) && ttisstring(rc)) {
+          const TValue *v = luaH_getfield(hvalue(rb), rawtsvalue(rc),
+                                          fieldcache(L, pc));
+          if (!ttisnil(v) || hvalue(rb)->metatable == NULL) {
+            setobj2s(L, ra, v);
+            continue;
+          }
+        }
+        Protect(luaV_gettable(L, rb, rc, ra));
         continue;
       }
       case OP_SETGLOBAL: {
@@ -463,20 +502,43 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         continue;
       }
       case OP_SETTABLE: {
-        Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttistable(ra) && ttisstring(rb)) {
+          Table *h = hvalue(ra);
+          TValue *v = cast(TValue *, luaH_getfield(h, rawtsvalue(rb),
+                                                   fieldcache(L, pc)));
+          if (!ttisnil(v)) {  /* existing field: no metamethod */
+            setobj2t(L, v, rc);
+            h->flags = 0;
+            luaC_barriert(L, h, rc);
+            continue;
+          }
+        }
+        Protect(luaV_settable(L, ra, rb, rc));
         continue;
       }
       case OP_NEWTABLE: {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
+        L->savedpc = pc;  /* allocation profiles report the current line */
         sethvalue(L, ra, luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
         Protect(luaC_checkGC(L));
         continue;
       }
       case OP_SELF: {
         StkId rb = RB(i);
+        TValue *rc = RKC(i);
         setobjs2s(L, ra+1, rb);
-        Protect(luaV_gettable(L, rb, RKC(i), ra));
+        if (ttistable(rb) && ttisstring(rc)) {
+          const TValue *v = luaH_getfield(hvalue(rb), rawtsvalue(rc),
+                                          fieldcache(L, pc));
+          if (!ttisnil(v)) {
+            setobj2s(L, ra, v);
+            continue;
+          }
+        }
+        Protect(luaV_gettable(L, rb, rc, ra));
         continue;
       }
       case OP_ADD: {
@@ -709,21 +771,23 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         int c = GETARG_C(i);
         int last;
         Table *h;
-        if (n == 0) {
+        if (n == 0)  /* `top' keeps the values alive while the array grows */
           n = cast_int(L->top - ra) - 1;
-          L->top = L->ci->top;
-        }
         if (c == 0) c = cast_int(*pc++);
         runtime_check(L, ttistable(ra));
         h = hvalue(ra);
         last = ((c-1)*LFIELDS_PER_FLUSH) + n;
-        if (last > h->sizearray)  /* needs more space? */
+        if (last > h->sizearray) {  /* needs more space? */
+          L->savedpc = pc;  /* allocation profiles report the current line */
           luaH_resizearray(L, h, last);  /* pre-alloc it at once */
+        }
         for (; n > 0; n--) {
           TValue *val = ra+n;
           setobj2t(L, luaH_setnum(L, h, last--), val);
           luaC_barriert(L, h, val);
         }
+        if (GETARG_B(i) == 0)
+          L->top = L->ci->top;
         continue;
       }
       case OP_CLOSE: {
@@ -737,8 +801,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         // Bx中存放的是在上层函数proto数组中的索引
         p = cl->p->p[GETARG_Bx(i)];
         nup = p->nups;
+        L->savedpc = pc;  /* allocation profiles report the current line */
         ncl = luaF_newLclosure(L, nup, cl->env);
         ncl->l.p = p;
+        setclvalue(L, ra, ncl);  /* anchor it while creating upvalues */
         // 紧跟着CLOSURE指令的是MOVE或者GETUPVAL指令
         // 如果是GETUPVAL, 则从上层函数的upval中寻找upval
         // 如果是MOVE, 则从
@@ -751,8 +817,6 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             ncl->l.upvals[j] = luaF_findupval(L, base + GETARG_B(*pc));
           }
         }
-        // 将创建好的closure存放到ra中
-        setclvalue(L, ra, ncl);
         Protect(luaC_checkGC(L));
         continue;
       }
@@ -0,0 +1,47 @@
+-- finalizers left to collectgarbage("runfinalizers") by "deferfinalizers"
+
+collectgarbage("deferfinalizers", true)
+
+-- drained in batches, objects found by an earlier cycle first
+local order = {}
+local function mk(tag, n)
+  for i = 1, n do
+    local u = newproxy(true)
+    getmetatable(u).__gc = function() order[#order+1] = tag end
+  end
+end
+mk("a", 3)
+collectgarbage()
+mk("b", 3)
+collectgarbage()
+assert(#order == 0, "finalizer ran before the drain")
+assert(collectgarbage("runfinalizers", 2) == 2)
+assert(collectgarbage("runfinalizers") == 4)
+assert(collectgarbage("runfinalizers") == 0)
+assert(table.concat(order) == "aaabbb", table.concat(order))
+
+-- a finalizer may store an object whose own finalizer is still pending;
+-- draining while the collector is marking must not free it
+local ballast = {}
+for i = 1, 2000 do ballast[i] = {i} end
+for steps = 0, 120, 8 do
+  local holder = {u = false}
+  root = {holder, ballast}	-- `holder' is marked before the ballast
+  do
+    local u, v = newproxy(true), newproxy(true)
+    getmetatable(u).__gc = function() end
+    getmetatable(u).__index = {ok = true}
+    getmetatable(v).__gc = function() holder.u = u end
+  end
+  collectgarbage()
+  for i = 1, steps do collectgarbage("step", 0) end
+  collectgarbage("runfinalizers")
+  repeat until collectgarbage("step", 0)	-- finish this cycle
+  assert(holder.u.ok)
+end
+root = nil
+
+assert(collectgarbage("deferfinalizers", false) == true)
+assert(collectgarbage("deferfinalizers", 1) == false)
+assert(collectgarbage("deferfinalizers", false) == true)
+print("finalizers ok")
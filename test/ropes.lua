@@ -0,0 +1,24 @@
+-- strings built by concatenation share their bytes with longer strings;
+-- check that a shorter one never sees the bytes after its end
+
+local m = string.rep("v", 300) .. "x"
+local longer = m .. "k"			-- shares (and extends) the bytes of m
+
+-- a weak-value table must not become weak-keyed
+local t = setmetatable({}, {__mode = m})
+local key = {}
+t[key] = true
+key = nil
+collectgarbage()
+assert(next(t) ~= nil, "__mode read past the end of its string")
+
+-- other readers of the shared bytes
+local s = string.rep("1", 300)
+local n = s .. "2"
+assert(tonumber(s) == tonumber(string.rep("1", 300)))
+assert(s < n and not (n < s) and s ~= n)
+assert(#s == 300 and #n == 301 and #longer == 302)
+assert(string.find(s, "2", 1, true) == nil)
+assert(string.format("%s", s) == string.rep("1", 300))
+
+print("ropes ok")